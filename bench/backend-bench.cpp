@@ -0,0 +1,237 @@
+//===-- backend-bench.cpp - Backend Benchmark -------------------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains benchmarks of TextBackend::send() for each
+/// format and compression setting, of the instrumentation overhead
+/// on send, and of TextBackend::receive(), Backend::results() and
+/// cached receives on files of varying length. Receiving a compressed
+/// file whose writer is still open is checked along the way, failing
+/// the run if it doesn't return every flushed record.
+///
+//===------------------------------------------------------------===//
+
+#include "bench.h"
+#include "backend.h"
+#include "cache.h"
+#include "stats.h"
+
+#include <fstream>
+#include <cstdio>
+#include <unistd.h>
+
+static void benchSend()
+{
+  using namespace film::bench;
+
+  std::vector<const char*> labels = sampleLabels();
+  std::vector<const char*> values = sampleValues();
+
+  for (const char* const* name = film::serializerNames; *name; ++name) {
+    for (int level : { 0, 1, 6 }) {
+      NullStreambuf nullbuf;
+      std::ostream nullstream(&nullbuf);
+      size_t iterations;
+      double percall;
+
+      {
+	film::TextBackend be(nullstream, level, film::makeSerializer(*name));
+
+	percall = timePerCall([&] { be.send(&labels, &values); },
+			      iterations);
+      }
+
+      Result("backend", "TextBackend::send")
+	.add("format", *name)
+	.add("compress_level", level)
+	.add("iterations", iterations)
+	.add("ns_per_op", percall * 1e9)
+	.emit();
+    }
+  }
+}
+
+/// Cost of the always-compiled instrumentation on the send path
+///
+/// An empty section is timed with stats on and off, since the cost is
+/// lost in the noise between two timings of send(), and reported
+/// against an uninstrumented send in each format.
+static void benchStatsOverhead()
+{
+  using namespace film::bench;
+
+  std::vector<const char*> labels = sampleLabels();
+  std::vector<const char*> values = sampleValues();
+  NullStreambuf nullbuf;
+  std::ostream nullstream(&nullbuf);
+  double section[2];
+  size_t iterations;
+
+  for (int enabled = 0; enabled < 2; ++enabled) {
+    fm_stats_enable(enabled ? FM_STATS_ENABLED : 0);
+    section[enabled] = timePerCall([] {
+      film::StatScope stat(FM_STAT_SEND);
+    }, iterations, 1.0);
+  }
+
+  fm_stats_enable(0);
+
+  double cost = section[1] - section[0];
+
+  for (const char* const* name = film::serializerNames; *name; ++name) {
+    film::TextBackend be(nullstream, 0, film::makeSerializer(*name));
+    double send = timePerCall([&] { be.send(&labels, &values); },
+			      iterations, 1.0);
+
+    Result("backend", "stats overhead")
+      .add("format", *name)
+      .add("ns_per_op", send * 1e9)
+      .add("section_ns", cost * 1e9)
+      .add("overhead_pct", 100.0 * cost / send)
+      .emit();
+  }
+}
+
+static void benchReceive(size_t nlines)
+{
+  using namespace film::bench;
+
+  char path[] = "/tmp/fm-bench-XXXXXX";
+  int fd = mkstemp(path);
+
+  if (fd < 0) {
+    std::perror("mkstemp");
+    return;
+  }
+
+  close(fd);
+
+  {
+    std::ofstream out(path);
+
+    for (size_t i = 0; i < nlines; ++i)
+      out << "Autocomplete entry " << i << '\n';
+  }
+
+  film::TextBackend be;
+  size_t iterations;
+
+  double receive = timePerCall([&] { be.receive(path); }, iterations);
+
+  Result("backend", "TextBackend::receive")
+    .add("lines", nlines)
+    .add("iterations", iterations)
+    .add("ns_per_op", receive * 1e9)
+    .add("lines_per_sec", nlines / receive)
+    .emit();
+
+  double results = timePerCall([&] { keep(be.results()); }, iterations);
+
+  Result("backend", "Backend::results")
+    .add("lines", nlines)
+    .add("iterations", iterations)
+    .add("ns_per_op", results * 1e9)
+    .emit();
+
+  film::CachedBackend cached(std::unique_ptr<film::Backend>(
+				new film::TextBackend), 1ul << 30);
+
+  cached.receive(path);
+
+  double hit = timePerCall([&] { cached.receive(path); }, iterations);
+
+  Result("backend", "CachedBackend::receive hit")
+    .add("lines", nlines)
+    .add("iterations", iterations)
+    .add("ns_per_op", hit * 1e9)
+    .add("speedup", receive / hit)
+    .emit();
+
+  std::remove(path);
+}
+
+/// Receive and page through a compressed file while its writer is
+/// still open, so the last gzip member ends at a sync flush
+static int benchReceiveOpenWriter(size_t nrecords)
+{
+  using namespace film::bench;
+
+  char path[] = "/tmp/fm-bench-XXXXXX";
+  int fd = mkstemp(path);
+
+  if (fd < 0) {
+    std::perror("mkstemp");
+    return 1;
+  }
+
+  close(fd);
+
+  std::vector<const char*> labels = sampleLabels();
+  std::vector<const char*> values = sampleValues();
+  std::ofstream out(path);
+  film::TextBackend writer(out, 6, film::makeSerializer("ndjson"));
+  film::TextBackend reader;
+  size_t iterations;
+  double receive = 0.0;
+  size_t rows = 0;
+
+  for (size_t i = 0; i < nrecords; ++i)
+    writer.send(&labels, &values);
+
+  writer.flush();
+
+  try {
+    receive = timePerCall([&] { reader.receive(path); }, iterations);
+
+    std::unique_ptr<film::Cursor> cursor = reader.cursor(path);
+    std::vector<const char*> page;
+
+    while (cursor->fetch(rows, 100, page) > 0)
+      rows += page.size();
+  }
+  catch (std::exception& e) {
+    std::cerr << "Receive with the writer open failed: " << e.what()
+	      << '\n';
+  }
+
+  std::remove(path);
+
+  if (reader.results().size() != nrecords || rows != nrecords) {
+    std::cerr << "Receive with the writer open read "
+	      << reader.results().size() << " records and paged " << rows
+	      << " of " << nrecords << '\n';
+    return 1;
+  }
+
+  Result("backend", "TextBackend::receive open writer")
+    .add("records", nrecords)
+    .add("iterations", iterations)
+    .add("ns_per_op", receive * 1e9)
+    .add("records_per_sec", nrecords / receive)
+    .emit();
+
+  return 0;
+}
+
+int main(int argc, const char** argv)
+{
+  benchSend();
+  benchStatsOverhead();
+
+  if (benchReceiveOpenWriter(10000) != 0)
+    return 1;
+
+  for (size_t n : film::bench::sizesFromArgs(argc, argv,
+					     { 100, 10000, 1000000 }))
+    benchReceive(n);
+
+  return 0;
+}
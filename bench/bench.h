@@ -0,0 +1,162 @@
+//===-- bench.h - Benchmark Harness Header ------------* C++ *----===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the timing and reporting helpers shared by the
+/// benchmarks. Every result is printed as one JSON object per line
+/// so runs from different releases can be collected and compared.
+///
+//===------------------------------------------------------------===//
+
+#ifndef BENCH_H
+#define BENCH_H
+
+#include <chrono>
+#include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <string>
+#include <vector>
+#include <cstdlib>
+
+#ifndef FM_VERSION
+#define FM_VERSION "unknown"
+#endif
+
+namespace film {
+  namespace bench {
+    /// Stream buffer that throws everything away
+    class NullStreambuf :public std::streambuf {
+    protected:
+      virtual int_type overflow(int_type ch) override
+      {
+	return traits_type::not_eof(ch);
+      }
+
+      virtual std::streamsize xsputn(const char*,
+				     std::streamsize n) override
+      {
+	return n;
+      }
+    };
+
+    /// Keep the compiler from discarding a computed value
+    template<typename T>
+    inline void keep(const T& val)
+    {
+      asm volatile("" : : "g"(&val) : "memory");
+    }
+
+    /// Seconds spent in one call of fn
+    template<typename F>
+    double timeOnce(F&& fn)
+    {
+      auto start = std::chrono::steady_clock::now();
+      fn();
+      std::chrono::duration<double> elapsed =
+	std::chrono::steady_clock::now() - start;
+
+      return elapsed.count();
+    }
+
+    /// Mean seconds per call of fn, repeating for at least mintime
+    template<typename F>
+    double timePerCall(F&& fn, size_t& iterations, double mintime = 0.2)
+    {
+      double total = 0.0;
+
+      iterations = 0;
+
+      for (size_t batch = 1; total < mintime; batch = batch * 2) {
+	total += timeOnce([&] {
+	  for (size_t i = 0; i < batch; ++i)
+	    fn();
+	});
+
+	iterations += batch;
+      }
+
+      return total / iterations;
+    }
+
+    /// One benchmark result, printed as a JSON line by emit()
+    class Result {
+    public:
+      Result(const char* suite, const char* name)
+      {
+	_out.precision(12);
+	_out << "{\"suite\": \"" << suite << "\", \"name\": \"" << name
+	     << "\", \"version\": \"" << FM_VERSION << '"';
+      }
+
+      template<typename T>
+      Result& add(const char* key, T val)
+      {
+	_out << ", \"" << key << "\": " << val;
+	return *this;
+      }
+
+      Result& add(const char* key, const char* val)
+      {
+	_out << ", \"" << key << "\": \"" << val << '"';
+	return *this;
+      }
+
+      void emit(std::ostream& out = std::cout)
+      {
+	out << _out.str() << "}\n";
+      }
+
+    private:
+      std::ostringstream _out;
+    };
+
+    /// Record counts from argv, or defaults if none were given
+    inline std::vector<size_t> sizesFromArgs(int argc, const char** argv,
+					     std::vector<size_t> defaults)
+    {
+      if (argc < 2)
+	return defaults;
+
+      std::vector<size_t> sizes;
+
+      for (int i = 1; i < argc; ++i)
+	sizes.push_back(std::strtoull(argv[i], NULL, 10));
+
+      return sizes;
+    }
+
+    /// The record layout used by the form, for synthetic corpora
+    inline const std::vector<const char*>& sampleLabels()
+    {
+      static const std::vector<const char*> labels = {
+	"Location", "Subject", "Date/time", "Camera", "Film Type",
+	"Film Set", "ID Number", "Camera Serial", "Lens Name",
+	"Lens Serial", "F number", "Focal Length"
+      };
+
+      return labels;
+    }
+
+    inline const std::vector<const char*>& sampleValues()
+    {
+      static const std::vector<const char*> values = {
+	"Yosemite Valley", "Half Dome, \"morning\"", "2021-06-14 06:32",
+	"Nikon F3", "Kodak Portra 400", "Roll 12", "12-27",
+	"1234567", "Nikkor 50mm f/1.4", "7654321", "8", "50"
+      };
+
+      return values;
+    }
+  }
+}
+
+#endif // #ifndef BENCH_H
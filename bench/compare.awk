@@ -0,0 +1,99 @@
+#===-- compare.awk - Benchmark Result Comparison ------------------===#
+#
+# Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+# software is released under the BSD 3-Clause "New" or "Revised"
+# License. You should have received a copy of the license with this
+# source distribution
+#
+# SPDX-License-Identifier: BSD-3-Clause
+#
+#===---------------------------------------------------------------===#
+#
+# Print each result of the plain, LTO and release (LTO and PGO) files
+# of benchmark output given in that order, with the speedup of LTO
+# over plain and of release over LTO, which is what the profile adds.
+# All files must come from the same benchmarks run in the same order.
+#
+#===---------------------------------------------------------------===#
+
+# Numeric value of key in a result line, or "" if it is missing
+function value(line, key,    s)
+{
+  if (!match(line, "\"" key "\": [-+0-9.e]+"))
+    return ""
+
+  s = substr(line, RSTART, RLENGTH)
+  sub(/.*: /, "", s)
+
+  return s + 0
+}
+
+function label(line,    s)
+{
+  match(line, /"name": "[^"]*"/)
+  s = substr(line, RSTART + 9, RLENGTH - 10)
+
+  if (match(line, /"format": "[^"]*"/))
+    s = s " " substr(line, RSTART + 11, RLENGTH - 12)
+
+  if (value(line, "records") != "")
+    s = s " (" value(line, "records") ")"
+
+  return s
+}
+
+# Speedup of new over old for the metric at index k
+function speedup(old, new, k)
+{
+  return k <= nlower ? old / new : new / old
+}
+
+# Index of the headline metric of a result into keys, or 0
+function metric(line,    i)
+{
+  for (i = 1; i <= nkeys; ++i) {
+    if (value(line, keys[i]) != "")
+      return i
+  }
+
+  return 0
+}
+
+BEGIN {
+  # Times first, where lower is better, then rates
+  nkeys = split("ns_per_op mean_us " \
+		"records_read_per_cpu_sec records_per_sec lines_per_sec",
+		keys, " ")
+  nlower = 2
+
+  printf "%-44s %12s %12s %12s %7s %7s\n", "benchmark", "plain", "lto",
+    "release", "lto", "pgo"
+}
+
+FILENAME == ARGV[1] {
+  base[FNR] = $0
+  next
+}
+
+FILENAME == ARGV[2] {
+  lto[FNR] = $0
+  next
+}
+
+{
+  k = metric($0)
+
+  if (k == 0 || !(FNR in base) || !(FNR in lto) ||
+      value(base[FNR], keys[k]) == "" || value(lto[FNR], keys[k]) == "")
+    next
+
+  plain = value(base[FNR], keys[k])
+  mid = value(lto[FNR], keys[k])
+  new = value($0, keys[k])
+
+  if (plain == 0 || mid == 0 || new == 0)
+    next
+
+  printf "%-44s %12.1f %12.1f %12.1f %6.2fx %6.2fx\n", label($0), plain,
+    mid, new, speedup(plain, mid, k), speedup(mid, new, k)
+}
@@ -0,0 +1,143 @@
+//===-- fields-bench.cpp - Form Field Benchmark -----------------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains benchmarks of autocomplete loading and of
+/// building form fields at varying field counts.
+///
+//===------------------------------------------------------------===//
+
+#include "bench.h"
+#include "app.h"
+
+#include <fstream>
+#include <cstdio>
+#include <unistd.h>
+
+/// Labels "Field 0" to "Field n-1", kept alive for the formdata
+static std::vector<const char*> makeLabels(size_t n,
+					   std::vector<std::string>& store)
+{
+  std::vector<const char*> labels;
+
+  store.clear();
+
+  for (size_t i = 0; i < n; ++i)
+    store.push_back("Field " + std::to_string(i));
+
+  for (const std::string& s : store)
+    labels.push_back(s.c_str());
+
+  return labels;
+}
+
+static void benchAutoComplete(size_t nentries, size_t nfields)
+{
+  using namespace film::bench;
+
+  char path[] = "/tmp/fm-bench-XXXXXX";
+  int fd = mkstemp(path);
+
+  if (fd < 0) {
+    std::perror("mkstemp");
+    return;
+  }
+
+  close(fd);
+
+  {
+    std::ofstream out(path);
+
+    for (size_t i = 0; i < nentries; ++i)
+      out << "Camera model " << i << '\n';
+  }
+
+  film::TextBackend be;
+  uint8_t modereg = FM_OP_BE_TEXT;
+  size_t iterations;
+
+  app.acfile = path;
+
+  double percall = timePerCall([&] {
+    keep(autoCompleteLists(be, modereg, nfields));
+  }, iterations);
+
+  Result("fields", "autoCompleteLists")
+    .add("entries", nentries)
+    .add("fields", nfields)
+    .add("iterations", iterations)
+    .add("ns_per_op", percall * 1e9)
+    .emit();
+
+  app.acfile.clear();
+  std::remove(path);
+}
+
+static void benchFields(size_t nfields)
+{
+  using namespace film::bench;
+
+  std::vector<std::string> store;
+  std::vector<const char*> labels = makeLabels(nfields, store);
+  NullStreambuf nullbuf;
+  std::ostream nullstream(&nullbuf);
+  film::TextBackend be(nullstream);
+  size_t iterations;
+
+  double generate = timePerCall([&] {
+    std::vector<formdata> fd;
+    generateFields(fd, labels);
+    keep(fd);
+  }, iterations);
+
+  Result("fields", "generateFields")
+    .add("fields", nfields)
+    .add("iterations", iterations)
+    .add("ns_per_op", generate * 1e9)
+    .emit();
+
+  std::vector<formdata> fd;
+  generateFields(fd, labels);
+
+  double process = timePerCall([&] { processFields(be, fd); },
+			       iterations);
+
+  Result("fields", "processFields")
+    .add("fields", nfields)
+    .add("iterations", iterations)
+    .add("ns_per_op", process * 1e9)
+    .emit();
+
+  double populate = timePerCall([&] {
+    allocateFields(nfields);
+    populateFields(&fd[0], nfields);
+    freeFields(nfields);
+  }, iterations);
+
+  Result("fields", "populateFields")
+    .add("fields", nfields)
+    .add("iterations", iterations)
+    .add("ns_per_op", populate * 1e9)
+    .emit();
+}
+
+int main(int argc, const char** argv)
+{
+  using namespace film::bench;
+
+  for (size_t n : sizesFromArgs(argc, argv, { 4, 12, 48, 120 }))
+    benchFields(n);
+
+  for (size_t n : { 100, 10000 })
+    benchAutoComplete(n, 12);
+
+  return 0;
+}
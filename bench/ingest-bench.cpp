@@ -0,0 +1,76 @@
+//===-- ingest-bench.cpp - End-to-End Ingest Benchmark ----------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains an end-to-end benchmark that pushes synthetic
+/// record corpora through the form helpers and a TextBackend. Pass
+/// record counts as arguments for corpora larger than the default,
+/// e.g. 10000000.
+///
+//===------------------------------------------------------------===//
+
+#include "bench.h"
+#include "app.h"
+
+#include <cstdio>
+#include <cstring>
+
+static void benchIngest(size_t nrecords, const char* format, int level)
+{
+  using namespace film::bench;
+
+  const std::vector<const char*>& labels = sampleLabels();
+  const std::vector<const char*>& values = sampleValues();
+  NullStreambuf nullbuf;
+  std::ostream nullstream(&nullbuf);
+  std::vector<formdata> fd;
+
+  double elapsed;
+
+  {
+    film::TextBackend be(nullstream, level, film::makeSerializer(format));
+
+    generateFields(fd, labels);
+
+    elapsed = timeOnce([&] {
+      for (size_t i = 0; i < nrecords; ++i) {
+	// Vary one field per record as real data would
+	for (size_t j = 0; j < fd.size(); ++j)
+	  strncpy(fd[j].data, values[j], sizeof(fd[j].data) - 1);
+
+	snprintf(fd[6].data, sizeof(fd[6].data), "%zu", i);
+	processFields(be, fd);
+      }
+    });
+  }
+
+  Result("ingest", "processFields")
+    .add("format", format)
+    .add("compress_level", level)
+    .add("records", nrecords)
+    .add("seconds", elapsed)
+    .add("records_per_sec", nrecords / elapsed)
+    .emit();
+}
+
+int main(int argc, const char** argv)
+{
+  using namespace film::bench;
+
+  for (size_t n : sizesFromArgs(argc, argv, { 10000, 100000, 1000000 })) {
+    for (const char* const* name = film::serializerNames; *name; ++name)
+      benchIngest(n, *name, 0);
+
+    benchIngest(n, "json", 1);
+  }
+
+  return 0;
+}
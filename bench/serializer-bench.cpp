@@ -0,0 +1,52 @@
+//===-- serializer-bench.cpp - Serializer Benchmark -------------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains a benchmark comparing the size and speed of
+/// each record output format.
+///
+//===------------------------------------------------------------===//
+
+#include "bench.h"
+#include "serializer.h"
+
+int main(int argc, const char** argv)
+{
+  using namespace film::bench;
+
+  const std::vector<const char*>& labels = sampleLabels();
+  const std::vector<const char*>& values = sampleValues();
+
+  for (size_t nrecords : sizesFromArgs(argc, argv, { 1000000 })) {
+    for (const char* const* name = film::serializerNames; *name; ++name) {
+      std::unique_ptr<film::Serializer> ser = film::makeSerializer(*name);
+      std::string buf;
+      size_t bytes = 0;
+
+      double elapsed = timeOnce([&] {
+	for (size_t i = 0; i < nrecords; ++i) {
+	  buf.clear();
+	  ser->write(buf, labels, values);
+	  bytes += buf.size();
+	}
+      });
+
+      Result("serializer", "write")
+	.add("format", *name)
+	.add("records", nrecords)
+	.add("bytes_per_record", (double) bytes / nrecords)
+	.add("records_per_sec", nrecords / elapsed)
+	.emit();
+    }
+  }
+
+  return 0;
+}
@@ -0,0 +1,97 @@
+//===-- shard-bench.cpp - Sharded Backend Benchmark -------------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains benchmarks of ShardedBackend queries for the
+/// latest year and the whole archive as the archive grows by years.
+///
+//===------------------------------------------------------------===//
+
+#include "bench.h"
+#include "shard.h"
+
+#include <filesystem>
+#include <cstdio>
+#include <cstdlib>
+
+static void benchArchive(size_t nyears, size_t perYear)
+{
+  using namespace film::bench;
+
+  char dir[] = "/tmp/fm-bench-XXXXXX";
+
+  if (mkdtemp(dir) == NULL) {
+    std::perror("mkdtemp");
+    return;
+  }
+
+  std::vector<const char*> labels = sampleLabels();
+  std::vector<const char*> values = sampleValues();
+  char date[32];
+  int lastyear = 2021;
+
+  values[2] = date;
+
+  {
+    film::ShardedBackend be(dir);
+
+    for (size_t y = 0; y < nyears; ++y) {
+      for (size_t i = 0; i < perYear; ++i) {
+	snprintf(date, sizeof(date), "%04zu-%02zu-%02zu 12:00",
+		 lastyear - y, i % 12 + 1, i % 28 + 1);
+	be.send(&labels, &values);
+      }
+    }
+
+    size_t iterations;
+    std::string year = std::to_string(lastyear);
+
+    double recent = timePerCall([&] { be.receive(year.c_str()); },
+				iterations);
+
+    Result("shard", "ShardedBackend::receive latest year")
+      .add("years", nyears)
+      .add("records", nyears * perYear)
+      .add("iterations", iterations)
+      .add("ns_per_op", recent * 1e9)
+      .emit();
+
+    double all = timePerCall([&] { be.receive("*"); }, iterations);
+
+    Result("shard", "ShardedBackend::receive all")
+      .add("years", nyears)
+      .add("records", nyears * perYear)
+      .add("iterations", iterations)
+      .add("ns_per_op", all * 1e9)
+      .emit();
+
+    snprintf(date, sizeof(date), "%04d-06-01 12:00", lastyear);
+
+    double send = timePerCall([&] { be.send(&labels, &values); },
+			      iterations);
+
+    Result("shard", "ShardedBackend::send latest year")
+      .add("years", nyears)
+      .add("iterations", iterations)
+      .add("ns_per_op", send * 1e9)
+      .emit();
+  }
+
+  std::filesystem::remove_all(dir);
+}
+
+int main(int argc, const char** argv)
+{
+  for (size_t n : film::bench::sizesFromArgs(argc, argv, { 10, 30, 60 }))
+    benchArchive(n, 2000);
+
+  return 0;
+}
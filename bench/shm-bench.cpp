@@ -0,0 +1,76 @@
+//===-- shm-bench.cpp - Shared Memory Transport Benchmark -------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains a benchmark of save round trips through the
+/// shared memory transport to a server in a child process.
+///
+//===------------------------------------------------------------===//
+
+#include "bench.h"
+#include "shm.h"
+
+#include <algorithm>
+#include <csignal>
+#include <unistd.h>
+#include <sys/wait.h>
+
+int main(int argc, const char** argv)
+{
+  using namespace film::bench;
+
+  std::string name = "fm-bench-" + std::to_string(getpid());
+  std::unique_ptr<film::ShmRing> ring(film::ShmRing::create(name));
+
+  pid_t child = fork();
+
+  if (child == 0) {
+    // The server touches nothing but the records
+    size_t fields = 0;
+    auto count = [&fields](std::vector<const char*>& keys,
+			   std::vector<const char*>&) {
+      fields += keys.size();
+    };
+
+    for (;;)
+      ring->consume(count, 1000);
+  }
+
+  film::ShmBackend be(name);
+  std::vector<const char*> labels = sampleLabels();
+  std::vector<const char*> values = sampleValues();
+
+  for (size_t n : sizesFromArgs(argc, argv, { 100000 })) {
+    std::vector<double> samples(n);
+
+    for (size_t i = 0; i < n; ++i)
+      samples[i] = timeOnce([&] { be.send(&labels, &values); });
+
+    std::sort(samples.begin(), samples.end());
+
+    double total = 0.0;
+
+    for (double s : samples)
+      total += s;
+
+    Result("shm", "ShmBackend::send")
+      .add("records", n)
+      .add("mean_us", total / n * 1e6)
+      .add("p50_us", samples[n / 2] * 1e6)
+      .add("p99_us", samples[n * 99 / 100] * 1e6)
+      .emit();
+  }
+
+  kill(child, SIGKILL);
+  waitpid(child, NULL, 0);
+
+  return 0;
+}
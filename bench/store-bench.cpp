@@ -0,0 +1,128 @@
+//===-- store-bench.cpp - Record Store Benchmark ----------------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains a mixed read/write benchmark of RecordStore:
+/// reader threads scanning snapshots, alone and then alongside a
+/// writer ingesting and updating records.
+///
+//===------------------------------------------------------------===//
+
+#include "bench.h"
+#include "store.h"
+
+#include <atomic>
+#include <thread>
+#include <cstdio>
+#include <ctime>
+
+/// CPU seconds used by the calling thread
+static double threadCpuTime()
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/// Records scanned per second by nreaders threads over seconds, with
+/// a bulk writer running if write is set. Reads per reader CPU second
+/// stay level if readers are never held up, even when the threads
+/// share fewer cores than they need.
+static void benchMixed(film::RecordStore& store, unsigned nreaders,
+		       bool write, double seconds)
+{
+  using namespace film::bench;
+
+  std::vector<const char*> labels = sampleLabels();
+  std::vector<const char*> values = sampleValues();
+  std::atomic<bool> stop(false);
+  std::atomic<uint64_t> scanned(0);
+  std::atomic<uint64_t> written(0);
+  std::atomic<uint64_t> readcpuns(0);
+  std::vector<std::thread> threads;
+
+  for (unsigned r = 0; r < nreaders; ++r) {
+    threads.emplace_back([&] {
+      size_t bytes = 0;
+      double cpu = threadCpuTime();
+
+      while (!stop.load(std::memory_order_relaxed)) {
+	std::unique_ptr<film::RecordStore::Snapshot> snap = store.snapshot();
+
+	for (uint64_t id = 0; id < snap->size(); ++id)
+	  bytes += snap->get(id)->values[6].size();
+
+	scanned += snap->size();
+      }
+
+      keep(bytes);
+      readcpuns += (threadCpuTime() - cpu) * 1e9;
+    });
+  }
+
+  if (write) {
+    threads.emplace_back([&] {
+      std::vector<size_t> fields = { 9 };
+      std::vector<const char*> serial = { "1111111" };
+      uint64_t n = 0;
+
+      // Bulk ingest, fixing a field of an earlier record as it goes
+      while (!stop.load(std::memory_order_relaxed)) {
+	uint64_t id = store.insert(labels, values);
+
+	store.update({ id / 2 }, fields, serial);
+	n += 2;
+      }
+
+      written += n;
+    });
+  }
+
+  std::chrono::duration<double> elapsed(seconds);
+  double took = timeOnce([&] {
+    std::this_thread::sleep_for(elapsed);
+    stop = true;
+
+    for (std::thread& t : threads)
+      t.join();
+  });
+
+  Result("store", write ? "RecordStore read with ingest"
+	 : "RecordStore read only")
+    .add("readers", nreaders)
+    .add("records", store.snapshot()->size())
+    .add("records_read_per_sec", scanned / took)
+    .add("records_read_per_cpu_sec", scanned / (readcpuns / 1e9))
+    .add("writes_per_sec", written / took)
+    .add("versions", store.versions())
+    .emit();
+}
+
+int main(int argc, const char** argv)
+{
+  using namespace film::bench;
+
+  unsigned nreaders = std::max(1u, std::thread::hardware_concurrency() / 2);
+
+  for (size_t n : sizesFromArgs(argc, argv, { 100000 })) {
+    film::RecordStore store;
+
+    for (size_t i = 0; i < n; ++i)
+      store.insert(sampleLabels(), sampleValues());
+
+    benchMixed(store, nreaders, false, 1.0);
+    benchMixed(store, nreaders, true, 1.0);
+  }
+
+  return 0;
+}
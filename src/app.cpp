@@ -0,0 +1,182 @@
+//===-- app.cpp - Application State Source ----------------------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the implementation of the helpers moving
+/// records between the form and a backend.
+///
+//===------------------------------------------------------------===//
+
+#include "app.h"
+#include "stats.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <cctype>
+#include <iostream>
+#include <stdexcept>
+#include <assert.h>
+#include <strings.h>
+
+App app;
+
+/// Position of a keyword standing alone in _stmt, ignoring case
+static size_t findKeyword(const std::string& _stmt, const char* _word,
+			  size_t _from = 0)
+{
+  size_t len = strlen(_word);
+
+  for (size_t i = _from; i + len <= _stmt.size(); ++i) {
+    if (strncasecmp(_stmt.c_str() + i, _word, len) == 0
+	&& (i == 0 || isspace((unsigned char) _stmt[i - 1]))
+	&& (i + len == _stmt.size()
+	    || isspace((unsigned char) _stmt[i + len])))
+      return i;
+  }
+
+  return std::string::npos;
+}
+
+static std::string trim(const std::string& _s)
+{
+  size_t first = _s.find_first_not_of(" \t");
+
+  if (first == std::string::npos)
+    return "";
+
+  return _s.substr(first, _s.find_last_not_of(" \t") - first + 1);
+}
+
+/// Split "Field = value" at the first '='
+static void splitAssignment(const std::string& _s, std::string& _key,
+			    std::string& _value)
+{
+  size_t eq = _s.find('=');
+
+  if (eq == std::string::npos) {
+    throw std::runtime_error("Expected Field = value in \"" + trim(_s)
+			     + '"');
+  }
+
+  _key = trim(_s.substr(0, eq));
+  _value = trim(_s.substr(eq + 1));
+
+  if (_key.empty()) {
+    throw std::runtime_error("Missing field name in \"" + trim(_s) + '"');
+  }
+}
+
+UpdateStatement parseUpdate(const std::string& _stmt)
+{
+  UpdateStatement us;
+  size_t where = findKeyword(_stmt, "where");
+  size_t set = findKeyword(_stmt, "set", where == std::string::npos
+			   ? 0 : where + 5);
+
+  if (where == std::string::npos || set == std::string::npos
+      || !trim(_stmt.substr(0, where)).empty()) {
+    throw std::runtime_error("Expected \"where Field = value set Field = "
+			     "value, ...\"");
+  }
+
+  splitAssignment(_stmt.substr(where + 5, set - where - 5), us.field,
+		  us.value);
+
+  // Assignments are separated by commas, so values can't hold them
+  std::string rest = _stmt.substr(set + 3);
+  size_t start = 0;
+
+  for (;;) {
+    size_t comma = rest.find(',', start);
+    std::string key;
+    std::string value;
+
+    splitAssignment(rest.substr(start, comma - start), key, value);
+    us.setkeys.push_back(key);
+    us.setvalues.push_back(value);
+
+    if (comma == std::string::npos)
+      break;
+
+    start = comma + 1;
+  }
+
+  return us;
+}
+
+/// Generate autocomplete information
+App::acvector autoCompleteLists(film::Backend& _be,
+				uint8_t& _modereg,
+				size_t len)
+{
+  film::StatScope stat(FM_STAT_AUTOCOMPLETE);
+  std::vector<std::vector<const char*>> _aclist;
+
+  if ((_modereg & FM_OP_BE_TEXT) == FM_OP_BE_TEXT) {
+    if (!app.acfile.empty()) {
+      try {
+	_be.receive(app.acfile.c_str());
+      }
+      catch (std::exception& e) {
+	std::cerr << "Failed to receive autocomplete info with error "
+		  << e.what();
+	exit(1);
+      }
+
+      _aclist.assign(len, _be.results());
+    }
+  }
+
+  return _aclist;
+}
+
+/// Generate the list of fields to fill out
+void generateFields(std::vector<formdata>& _formdata,
+		    const std::vector<const char*>& _labels)
+{
+  // Copy labels to formdata struct
+  for (uint16_t i = 0; i < _labels.size(); ++i) {
+    _formdata.push_back(formdata());
+    formdata& fd = _formdata.back();
+    fd = {
+      .name = "",
+      .data = "",
+      .aclist = NULL,
+      .naclist = 0
+    };
+
+    if (!app.aclist.empty()) {
+      fd.aclist = (char* const*) &app.aclist.at(i)[0];
+      fd.naclist = app.aclist[i].size();
+    }
+
+    strncpy(fd.name, _labels[i], sizeof(fd.name)/sizeof(char));
+  }
+}
+
+/// Export field information to backend
+int processFields(film::Backend& _backend,
+		  const std::vector<formdata>& _fd)
+{
+  std::vector<const char*> labels;
+  std::vector<const char*> datas;
+
+  assert(_fd.size() > 0);
+
+  for (uint16_t i = 0; i < _fd.size(); ++i) {
+    labels.push_back(_fd[i].name);
+    datas.push_back(_fd[i].data);
+  }
+
+  _backend.send(&labels, &datas);
+
+  return 0;
+}
@@ -0,0 +1,88 @@
+//===-- app.h - Application State Header --------------* C++ *----===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the application global state and the helpers
+/// that move records between the form and a backend, kept apart from
+/// main() so the benchmarks can link against them.
+///
+//===------------------------------------------------------------===//
+
+#ifndef APP_H
+#define APP_H
+
+#include "fields_magic.h"
+#include "backend.h"
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <list>
+
+// Program operating modes
+#define FM_OP_USAGE		0x01
+#define FM_OP_VERSION		0x02
+#define FM_OP_INTERACTIVE	0x04
+#define FM_OP_BE_TEXT		0x08
+#define FM_OP_SCAN		0x10
+#define FM_OP_WATCH		0x20
+#define FM_OP_BROWSE		0x40
+#define FM_OP_UPDATE		0x80
+
+/// Class to store application global variables and methods
+class App {
+public:
+  typedef std::vector<std::vector<const char*>> acvector;
+  acvector aclist;
+  std::string acfile;
+  int compresslevel = 0;
+  std::string format = "json";
+  std::string scandir;
+  std::string cursorfile;
+  std::vector<std::string> backends;
+  std::list<std::ofstream> outfiles;
+  std::string tracefile;
+  int statflags = 0;
+  std::string shmserve;
+  size_t cachesize = 8 << 20;
+  std::string cachefile;
+  std::string browsequery;
+  std::string updatestmt;
+};
+
+extern App app;
+
+/// Bulk update parsed from "where Field = value set Field = value,
+/// ..."
+struct UpdateStatement {
+  std::string field;
+  std::string value;
+  std::vector<std::string> setkeys;
+  std::vector<std::string> setvalues;
+};
+
+/// Parse an update statement, throwing on a syntax error
+UpdateStatement parseUpdate(const std::string& _stmt);
+
+/// Generate autocomplete information
+App::acvector autoCompleteLists(film::Backend& _be,
+				uint8_t& _modereg,
+				size_t len);
+
+/// Generate the list of fields to fill out
+void generateFields(std::vector<formdata>& _formdata,
+		    const std::vector<const char*>& _labels);
+
+/// Export field information to backend
+int processFields(film::Backend& _backend,
+		  const std::vector<formdata>& _fd);
+
+#endif // #ifndef APP_H
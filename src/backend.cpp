@@ -16,21 +16,501 @@
 //===------------------------------------------------------------===//
 
 #include "backend.h"
+#include "stats.h"
 
-#include <fstream>
 #include <vector>
+#include <algorithm>
+#include <stdexcept>
 #include <assert.h>
 #include <cstdarg>
+#include <cstdint>
+#include <climits>
+#include <cctype>
+#include <cerrno>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
 
-film::TextBackend::TextBackend(std::ostream& outstream)
-  :_outstream(outstream)
+#include <map>
+#include <unordered_map>
+
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+// Rows between the file offsets a TextCursor keeps
+#define FM_CURSOR_STRIDE	256
+
+// Delta records are NDJSON objects with the IDs they change under
+// this key and each changed field under its index
+#define FM_DELTA_KEY		"@ids"
+
+// Suffix of the file beside a record file that says where its deltas
+// start, as the uncompressed offset and the records before it
+#define FM_DELTA_INDEX		".deltas"
+
+static const char deltaPrefix[] = "{\"" FM_DELTA_KEY "\":";
+
+static bool isDelta(const std::string& line)
+{
+  return line.compare(0, sizeof(deltaPrefix) - 1, deltaPrefix) == 0;
+}
+
+/// Whether the compressed data of path ends at offset with the empty
+/// stored block of a sync flush, where a writer still open leaves it
+static bool endsFlushed(const char* path, z_off_t offset)
+{
+  static const unsigned char marker[] = { 0x00, 0x00, 0xff, 0xff };
+  unsigned char tail[sizeof(marker)];
+  int fd = open(path, O_RDONLY);
+  bool flushed;
+
+  if (fd < 0 || offset < (z_off_t) sizeof(tail))
+    flushed = false;
+  else
+    flushed = pread(fd, tail, sizeof(tail), offset - sizeof(tail))
+      == (ssize_t) sizeof(tail)
+      && std::memcmp(tail, marker, sizeof(tail)) == 0;
+
+  if (fd >= 0)
+    close(fd);
+
+  return flushed;
+}
+
+/// Why reading file at path stopped short of its end, or "" if it
+/// didn't
+///
+/// gzgets() returns NULL at the end of the file and on corrupt or
+/// cut-off compressed data alike, so only this tells them apart. A
+/// member that stops after a sync flush is one still being written,
+/// and everything before the flush is whole.
+static std::string readError(gzFile file, const char* path)
+{
+  int err;
+  const char* msg = gzerror(file, &err);
+
+  if (err == Z_ERRNO)
+    return std::string("Failed to read records: ") + std::strerror(errno);
+
+  if (err == Z_DATA_ERROR
+      || (err == Z_BUF_ERROR && !endsFlushed(path, gzoffset(file))))
+    return std::string("Failed to read records: ") + msg;
+
+  return "";
+}
+
+/// Read the delta index of the file at path into offset and records,
+/// returning false if it has none
+///
+/// An index that can't be read makes the whole file be read for
+/// deltas rather than any be missed.
+static bool readIndex(const char* path, z_off_t& offset, size_t& records)
+{
+  std::string index = std::string(path) + FM_DELTA_INDEX;
+  FILE* f = std::fopen(index.c_str(), "r");
+  long long off;
+  unsigned long long n;
+
+  if (f == NULL)
+    return errno != ENOENT;
+
+  if (std::fscanf(f, "%lld %llu", &off, &n) == 2 && off >= 0) {
+    offset = off;
+    records = n;
+  }
+  else {
+    offset = 0;
+    records = 0;
+  }
+
+  std::fclose(f);
+
+  return true;
+}
+
+/// Write sorted IDs as comma-separated values and ranges, "3,7-9"
+static std::string formatIds(std::vector<uint64_t> ids)
+{
+  std::string out;
+
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+  for (size_t i = 0; i < ids.size(); ++i) {
+    size_t j = i;
+
+    while (j + 1 < ids.size() && ids[j + 1] == ids[j] + 1)
+      j++;
+
+    if (!out.empty())
+      out.push_back(',');
+
+    out.append(std::to_string(ids[i]));
+
+    if (j > i)
+      out.append("-" + std::to_string(ids[j]));
+
+    i = j;
+  }
+
+  return out;
+}
+
+/// Call fn on each ID below limit in a list written by formatIds()
+template<typename F>
+static void forEachId(const std::string& list, uint64_t limit, F fn)
+{
+  const char* p = list.c_str();
+
+  while (*p) {
+    char* end;
+    uint64_t first = std::strtoull(p, &end, 10);
+    uint64_t last = first;
+
+    if (end == p)
+      break;
+
+    if (*end == '-')
+      last = std::strtoull(end + 1, &end, 10);
+
+    for (uint64_t id = first; id <= last && id < limit; ++id)
+      fn(id);
+
+    if (*end != ',')
+      break;
+
+    p = end + 1;
+  }
+}
+
+/// Delta lines read from a record file, indexed by the records they
+/// change
+class DeltaLog {
+public:
+  /// Take in a delta line read after nrecords records, which are all
+  /// it can change
+  void add(const std::string& line, uint64_t nrecords)
+  {
+    if (!film::parseNdjson(line, _keys, _values))
+      return;
+
+    Delta d;
+
+    for (size_t i = 1; i < _keys.size(); ++i) {
+      d.fields.emplace_back(std::strtoul(_keys[i].c_str(), NULL, 10),
+			    std::move(_values[i]));
+    }
+
+    forEachId(_values[0], nrecords, [&](uint64_t id) {
+      _byid[id].push_back(_deltas.size());
+    });
+
+    _deltas.push_back(std::move(d));
+  }
+
+  /// Apply every delta to record id, read as line, in file order
+  void apply(uint64_t id, std::string& line)
+  {
+    auto it = _byid.find(id);
+
+    if (it == _byid.end() || !film::parseNdjson(line, _keys, _values))
+      return;
+
+    for (size_t d : it->second) {
+      for (const auto& f : _deltas[d].fields) {
+	if (f.first < _values.size())
+	  _values[f.first] = f.second;
+      }
+    }
+
+    std::vector<const char*> k;
+    std::vector<const char*> v;
+
+    for (size_t i = 0; i < _keys.size(); ++i) {
+      k.push_back(_keys[i].c_str());
+      v.push_back(_values[i].c_str());
+    }
+
+    line.clear();
+    _ndjson.write(line, k, v);
+    line.pop_back();
+  }
+
+  /// IDs of the records with deltas, in ascending order
+  std::vector<uint64_t> ids() const
+  {
+    std::vector<uint64_t> out;
+
+    for (const auto& p : _byid)
+      out.push_back(p.first);
+
+    std::sort(out.begin(), out.end());
+
+    return out;
+  }
+
+private:
+  struct Delta {
+    std::vector<std::pair<size_t, std::string>> fields;
+  };
+
+  std::vector<Delta> _deltas;
+  std::unordered_map<uint64_t, std::vector<size_t>> _byid;
+  std::vector<std::string> _keys;
+  std::vector<std::string> _values;
+  film::NdjsonSerializer _ndjson;
+};
+
+/// Cursor over results already received in full
+class ResultCursor :public film::Cursor {
+public:
+  ResultCursor(std::vector<std::string>&& results)
+    :_results(std::move(results)) {}
+
+  virtual size_t fetch(size_t row, size_t n,
+		       std::vector<const char*>& rows) override
+  {
+    rows.clear();
+
+    for (size_t i = row; i < _results.size() && i - row < n; ++i)
+      rows.push_back(_results[i].c_str());
+
+    return rows.size();
+  }
+
+  virtual size_t size() const override { return _results.size(); }
+
+private:
+  std::vector<std::string> _results;
+};
+
+/// Cursor reading a record file a page at a time
+///
+/// Only the current page is held, along with the offset of every
+/// FM_CURSOR_STRIDE'th row, so going back means seeking to the
+/// nearest offset and skipping forward. Seeking backwards in a gzip
+/// file restarts decompression from the beginning. Deltas are
+/// collected on opening by reading from where the file's delta index
+/// says they start, so a file without one opens without reading it,
+/// and its number of rows is found when the last is read.
+class TextCursor :public film::Cursor {
+public:
+  TextCursor(const char* path)
+    :_path(path)
+  {
+    _file = gzopen(path, "rb");
+
+    if (_file == NULL) {
+      throw std::runtime_error("Failed to open file for receive");
+    }
+
+    gzbuffer(_file, 1 << 17);
+    _marks.push_back(0);
+
+    z_off_t offset = 0;
+    size_t records = 0;
+
+    if (readIndex(path, offset, records))
+      scanDeltas(offset, records);
+  }
+
+  virtual ~TextCursor() { gzclose(_file); }
+
+  virtual size_t fetch(size_t row, size_t n,
+		       std::vector<const char*>& rows) override;
+
+  virtual size_t size() const override { return _size; }
+
+private:
+  bool readLine(std::string& line);
+  void scanDeltas(z_off_t offset, size_t records);
+  void seek(size_t row);
+
+  std::string _path;
+  gzFile _file;
+  std::vector<z_off_t> _marks;
+  size_t _size = SIZE_MAX;
+  DeltaLog _deltas;
+
+  // The page holds rows [_first, _next), and the file is at _next
+  size_t _first = 0;
+  size_t _next = 0;
+  std::vector<std::string> _page;
+};
+
+/// Collect the deltas from offset to the end, with records rows
+/// before offset, then go back to the start
+void TextCursor::scanDeltas(z_off_t offset, size_t records)
+{
+  char chunk[4096];
+  std::string line;
+
+  if (gzseek(_file, offset, SEEK_SET) != offset) {
+    throw std::runtime_error("Failed to seek in file");
+  }
+
+  while (gzgets(_file, chunk, sizeof(chunk)) != NULL) {
+    line.append(chunk);
+
+    if (line.back() != '\n' && !gzeof(_file))
+      continue;
+
+    if (line.back() == '\n')
+      line.pop_back();
+
+    if (isDelta(line))
+      _deltas.add(line, records);
+    else if (!line.empty())
+      records++;
+
+    line.clear();
+  }
+
+  std::string err = readError(_file, _path.c_str());
+
+  if (!err.empty())
+    throw std::runtime_error(err);
+
+  _size = records;
+
+  if (gzrewind(_file) != 0) {
+    throw std::runtime_error("Failed to seek in file");
+  }
+}
+
+/// Read the next non-empty line, as receive() would, noting the
+/// offset of each stride and, until the rows are counted, the deltas
+bool TextCursor::readLine(std::string& line)
+{
+  char chunk[4096];
+
+  if (_next % FM_CURSOR_STRIDE == 0
+      && _next / FM_CURSOR_STRIDE == _marks.size())
+    _marks.push_back(gztell(_file));
+
+  line.clear();
+
+  while (gzgets(_file, chunk, sizeof(chunk)) != NULL) {
+    line.append(chunk);
+
+    if (line.back() != '\n' && !gzeof(_file))
+      continue;
+
+    if (line.back() == '\n')
+      line.pop_back();
+
+    // Rows are numbered as records, so deltas are passed over
+    if (isDelta(line)) {
+      if (_size == SIZE_MAX)
+	_deltas.add(line, _next);
+    }
+    else if (!line.empty()) {
+      _next++;
+      return true;
+    }
+
+    line.clear();
+  }
+
+  std::string err = readError(_file, _path.c_str());
+
+  if (!err.empty())
+    throw std::runtime_error(err);
+
+  _size = _next;
+
+  return false;
+}
+
+void TextCursor::seek(size_t row)
+{
+  std::string line;
+  size_t mark = row / FM_CURSOR_STRIDE;
+
+  if (mark >= _marks.size())
+    mark = _marks.size() - 1;
+
+  // Nothing before the next row needs a seek
+  if (row < _next || mark * FM_CURSOR_STRIDE > _next) {
+    if (gzseek(_file, _marks[mark], SEEK_SET) < 0) {
+      throw std::runtime_error("Failed to seek in file");
+    }
+
+    _next = mark * FM_CURSOR_STRIDE;
+  }
+
+  while (_next < row && readLine(line))
+    ;
+
+  _first = _next;
+  _page.clear();
+}
+
+size_t TextCursor::fetch(size_t row, size_t n,
+			 std::vector<const char*>& rows)
 {
+  film::StatScope stat(FM_STAT_FETCH);
+
+  // Paging forward keeps the overlap and reads only what follows it
+  if (row >= _first && row <= _next)
+    _page.erase(_page.begin(), _page.begin() + (row - _first));
+  else
+    seek(row);
+
+  _first = row < _next ? row : _next;
+
+  while (_page.size() < n) {
+    std::string line;
+
+    if (!readLine(line))
+      break;
+
+    _deltas.apply(_next - 1, line);
+    _page.push_back(std::move(line));
+  }
+
+  rows.clear();
+
+  for (size_t i = 0; i < _page.size() && i < n; ++i)
+    rows.push_back(_page[i].c_str());
+
+  return rows.size();
+}
+
+film::TextBackend::TextBackend(std::ostream& outstream,
+			       int compresslevel,
+			       std::unique_ptr<Serializer> serializer,
+			       const char* path)
+  :_path(path ? path : ""), _outstream(outstream.rdbuf()),
+   _serializer(std::move(serializer))
+{
+  if (!_serializer)
+    _serializer.reset(new JsonSerializer);
+
+  // Interpose a gzip stream buffer between the records and the
+  // caller's stream when compression is requested
+  if (compresslevel > 0) {
+    _zbuf.reset(new DeflateStreambuf(outstream.rdbuf(), compresslevel));
+    _outstream.rdbuf(_zbuf.get());
+  }
+
   flags = flags | FM_BE_RECEIVE_ENABLED;
   init();
 }
 
+film::TextBackend::~TextBackend()
+{
+  // Push out whatever the compressor still holds before the caller's
+  // stream goes away
+  _outstream.rdbuf(nullptr);
+  _zbuf.reset();
+}
+
 void film::TextBackend::send(std::vector<const char*>* v...)
 {
+  StatScope stat(FM_STAT_SEND);
   std::va_list args;
 
   assert(v);
@@ -42,19 +522,12 @@ void film::TextBackend::send(std::vector<const char*>* v...)
 
   assert(varg);
 
-  _outstream << "{\n";
-
-  for (uint16_t i = 0; i < v->size(); ++i) {
-    _outstream << '\t' << "\"" << v->at(i) << "\": "
-	       << "\"" << varg->at(i) << "\"";
-
-    if (i < v->size() - 1)
-      _outstream << ",";
-
-    _outstream << '\n';
-  }
+  va_end(args);
 
-  _outstream << "}\n";
+  // Reuse the buffer's capacity so steady-state sends don't allocate
+  _sendbuffer.clear();
+  _serializer->write(_sendbuffer, *v, *varg);
+  _outstream.write(_sendbuffer.data(), _sendbuffer.size());
 }
 
 const char* film::TextBackend::receive(const char* query)
@@ -65,32 +538,300 @@ const char* film::TextBackend::receive(const char* query)
 
   assert(query);
 
-  std::ifstream datafile;
+  StatScope stat(FM_STAT_RECEIVE);
+
+  // gzopen() reads plain files transparently, so compressed and
+  // uncompressed records are both decompressed a block at a time
+  gzFile datafile = gzopen(query, "rb");
 
   resultbuffer.clear();
-  datafile.open(query);
 
-  if (datafile.fail()) {
-    std::runtime_error("Failed to open file for receive");
+  if (datafile == NULL) {
+    throw std::runtime_error("Failed to open file for receive");
   }
 
-  while (!datafile.eof()) {
-    std::string line;
-    getline(datafile, line);
+  gzbuffer(datafile, 1 << 17);
+
+  char chunk[4096];
+  std::string line;
+
+  // Records changed by deltas are rewritten once at the end, so any
+  // number of deltas costs a single pass
+  DeltaLog deltas;
+
+  while (gzgets(datafile, chunk, sizeof(chunk)) != NULL) {
+    line.append(chunk);
+
+    // Long lines arrive over several reads
+    if (line.back() != '\n' && !gzeof(datafile))
+      continue;
+
+    if (line.back() == '\n')
+      line.pop_back();
 
-    if (!line.empty())
+    if (isDelta(line))
+      deltas.add(line, resultbuffer.size());
+    else if (!line.empty())
       resultbuffer.push_back(move(line));
+
+    line.clear();
   }
 
-  datafile.close();
+  std::string err = readError(datafile, query);
+
+  gzclose(datafile);
+
+  if (!err.empty())
+    throw std::runtime_error(err);
+
+  for (uint64_t id : deltas.ids())
+    deltas.apply(id, resultbuffer[id]);
 
   return "";
 }
 
-void film::TextBackend::connect() {};
+/// Write the delta index of the file at _path, unless it has one,
+/// before update() first appends a delta there
+///
+/// Deltas are only ever appended, so an index stays right as the file
+/// grows. The records our stream hasn't written out yet come after
+/// the offset found, so they are counted when the index is read.
+void film::TextBackend::indexDeltas()
+{
+  std::string index = _path + FM_DELTA_INDEX;
+
+  if (_path.empty() || access(index.c_str(), F_OK) == 0)
+    return;
+
+  gzFile datafile = gzopen(_path.c_str(), "rb");
+  z_off_t offset = 0;
+  unsigned long long records = 0;
+
+  if (datafile != NULL) {
+    char chunk[4096];
+    std::string line;
+
+    gzbuffer(datafile, 1 << 17);
+
+    while (gzgets(datafile, chunk, sizeof(chunk)) != NULL) {
+      line.append(chunk);
+
+      if (line.back() != '\n' && !gzeof(datafile))
+	continue;
+
+      if (line.back() == '\n')
+	line.pop_back();
+
+      // Deltas written without an index are found from the first
+      if (isDelta(line))
+	break;
+
+      if (!line.empty())
+	records++;
+
+      offset = gztell(datafile);
+      line.clear();
+    }
+
+    std::string err = readError(datafile, _path.c_str());
+
+    gzclose(datafile);
+
+    if (!err.empty())
+      throw std::runtime_error(err);
+  }
+
+  // Readers see either no index or a whole one
+  std::string tmp = index + ".tmp";
+  FILE* f = std::fopen(tmp.c_str(), "w");
+  bool written = f != NULL
+    && std::fprintf(f, "%lld %llu\n", (long long) offset, records) > 0;
+
+  if (f != NULL && std::fclose(f) != 0)
+    written = false;
+
+  if (!written || std::rename(tmp.c_str(), index.c_str()) != 0) {
+    std::remove(tmp.c_str());
+    throw std::runtime_error("Failed to write delta index " + index);
+  }
+}
+
+/// Append one delta record covering every ID
+void film::TextBackend::update(const std::vector<uint64_t>& ids,
+			       const std::vector<size_t>& fields,
+			       const std::vector<const char*>& values)
+{
+  StatScope stat(FM_STAT_SEND);
+
+  assert(fields.size() == values.size());
+
+  if (ids.empty())
+    return;
+
+  indexDeltas();
+
+  std::vector<std::string> names = { formatIds(ids) };
+  std::vector<const char*> keys = { FM_DELTA_KEY };
+  std::vector<const char*> vals;
+
+  for (size_t f : fields)
+    names.push_back(std::to_string(f));
+
+  vals.push_back(names[0].c_str());
+
+  for (size_t i = 0; i < fields.size(); ++i) {
+    keys.push_back(names[i + 1].c_str());
+    vals.push_back(values[i]);
+  }
+
+  // Deltas are read back line by line, whatever the records' format
+  NdjsonSerializer ndjson;
+
+  _sendbuffer.clear();
+  ndjson.write(_sendbuffer, keys, vals);
+  _outstream.write(_sendbuffer.data(), _sendbuffer.size());
+}
+
+void film::TextBackend::connect()
+{
+  StatScope stat(FM_STAT_CONNECT);
+}
 
 void film::TextBackend::init() {};
 
+void film::TextBackend::flush()
+{
+  _outstream.flush();
+}
+
+uint64_t film::TextBackend::version(const char* query)
+{
+  struct stat st;
+
+  // A file we can't stat never matches, so the next receive() reports
+  // the error
+  if (stat(query, &st) != 0)
+    return UINT64_MAX;
+
+  return ((uint64_t) st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec)
+    ^ ((uint64_t) st.st_size << 32);
+}
+
+std::string film::TextBackend::normalize(const char* query) const
+{
+  std::string q(query);
+
+  // Spaces inside a path are significant, so only the ends are
+  // trimmed before the path itself is normalized
+  q.erase(0, q.find_first_not_of(" \t\n"));
+  q.erase(q.find_last_not_of(" \t\n") + 1);
+
+  return q.empty() ? q
+    : std::filesystem::path(q).lexically_normal().string();
+}
+
+std::unique_ptr<film::Cursor> film::TextBackend::cursor(const char* query)
+{
+  assert(query);
+
+  if ((flags & FM_BE_RECEIVE_ENABLED) == 0) {
+    return std::unique_ptr<Cursor>(new ResultCursor({}));
+  }
+
+  return std::unique_ptr<Cursor>(new TextCursor(query));
+}
+
+void film::Backend::update(const std::vector<uint64_t>& ids,
+			   const std::vector<size_t>& fields,
+			   const std::vector<const char*>& values)
+{
+  throw std::runtime_error("Backend does not support updates");
+}
+
+size_t film::Backend::updateWhere(const char* query, const char* field,
+				  const char* value,
+				  const std::vector<const char*>& setkeys,
+				  const std::vector<const char*>& setvalues)
+{
+  assert(setkeys.size() == setvalues.size());
+
+  std::vector<std::string> keys;
+  std::vector<std::string> values;
+  size_t matched = 0;
+  size_t parsed = 0;
+
+  // Records sharing a layout change together, in one update each
+  std::map<std::vector<size_t>, std::vector<uint64_t>> groups;
+
+  receive(query);
+
+  for (uint64_t id = 0; id < resultbuffer.size(); ++id) {
+    if (!parseNdjson(resultbuffer[id], keys, values))
+      continue;
+
+    parsed++;
+
+    auto where = std::find(keys.begin(), keys.end(), field);
+
+    if (where == keys.end() || values[where - keys.begin()] != value)
+      continue;
+
+    std::vector<size_t> fields;
+
+    for (const char* k : setkeys) {
+      auto it = std::find(keys.begin(), keys.end(), k);
+
+      if (it == keys.end()) {
+	throw std::runtime_error(std::string("No field ") + k
+				 + " in record " + std::to_string(id));
+      }
+
+      fields.push_back(it - keys.begin());
+    }
+
+    groups[fields].push_back(id);
+    matched++;
+  }
+
+  // Records in another format would otherwise just never match
+  if (parsed == 0 && !resultbuffer.empty()) {
+    throw std::runtime_error("Records must be in the ndjson format to be "
+			     "updated");
+  }
+
+  for (auto& g : groups)
+    update(g.second, g.first, setvalues);
+
+  return matched;
+}
+
+std::unique_ptr<film::Cursor> film::Backend::cursor(const char* query)
+{
+  receive(query);
+
+  return std::unique_ptr<Cursor>(new ResultCursor(std::move(resultbuffer)));
+}
+
+std::string film::Backend::normalize(const char* query) const
+{
+  std::string q;
+
+  assert(query);
+
+  // Trim the ends and collapse runs of whitespace
+  for (const char* c = query; *c; ++c) {
+    if (!std::isspace((unsigned char) *c))
+      q.push_back(*c);
+    else if (!q.empty() && q.back() != ' ')
+      q.push_back(' ');
+  }
+
+  if (!q.empty() && q.back() == ' ')
+    q.pop_back();
+
+  return q;
+}
+
 std::vector<const char*> film::Backend::results()
 {
   std::vector<const char*> v;
@@ -19,13 +19,35 @@
 #ifndef BACKEND_H
 #define BACKEND_H
 
+#include "compress.h"
+#include "serializer.h"
+
 #include <iostream>
 #include <vector>
 #include <string>
+#include <memory>
 
 #define FM_BE_RECEIVE_ENABLED 0x01
 
+// receive() and cursor() may run on one thread while another sends,
+// each answering from a consistent snapshot
+#define FM_BE_CONCURRENT_READS 0x02
+
 namespace film {
+  /// Position in the results of a query, read a page at a time
+  class Cursor {
+  public:
+    /// Read up to n results starting at row, returning how many
+    /// were read. They stay valid until the next call.
+    virtual size_t fetch(size_t row, size_t n,
+			 std::vector<const char*>& rows) = 0;
+
+    /// Number of results, once the end has been read, or SIZE_MAX
+    virtual size_t size() const = 0;
+
+    virtual ~Cursor() {};
+  };
+
   /// Abstract class to describe backends that accept data
   class Backend {
   public:
@@ -35,6 +57,32 @@ namespace film {
     virtual const char* receive(const char* query) = 0;
     virtual void connect() = 0;
     virtual void init() = 0;
+    virtual void flush() {};
+
+    /// Version of the data answering query, changing whenever the
+    /// results would, or 0 if the backend does not track it
+    virtual uint64_t version(const char* query) { return 0; }
+
+    /// Canonical form of query, equal for queries with equal results
+    virtual std::string normalize(const char* query) const;
+
+    /// Change the fields at the given indexes in each of the records
+    /// ids, numbered from 0 in the order they were sent
+    virtual void update(const std::vector<uint64_t>& ids,
+			const std::vector<size_t>& fields,
+			const std::vector<const char*>& values);
+
+    /// Set the fields named by setkeys in every record of query
+    /// whose field equals value, returning how many matched
+    size_t updateWhere(const char* query, const char* field,
+		       const char* value,
+		       const std::vector<const char*>& setkeys,
+		       const std::vector<const char*>& setvalues);
+
+    /// Open the results of query for paging. Backends that can't
+    /// stream them receive() everything up front.
+    virtual std::unique_ptr<Cursor> cursor(const char* query);
+
     virtual ~Backend() {};
 
   protected:
@@ -47,10 +95,29 @@ namespace film {
     virtual const char* receive(const char* query) override;
     virtual void connect() override;
     virtual void init() override;
-    TextBackend(std::ostream& outstream = std::cout);
+    virtual void flush() override;
+    virtual uint64_t version(const char* query) override;
+    virtual std::string normalize(const char* query) const override;
+    virtual std::unique_ptr<Cursor> cursor(const char* query) override;
+    virtual void update(const std::vector<uint64_t>& ids,
+			const std::vector<size_t>& fields,
+			const std::vector<const char*>& values) override;
+    /// path names the file outstream appends to, if any, so the
+    /// deltas update() writes there can be found without a full read
+    TextBackend(std::ostream& outstream = std::cout,
+		int compresslevel = 0,
+		std::unique_ptr<Serializer> serializer = nullptr,
+		const char* path = nullptr);
+    virtual ~TextBackend();
 
   private:
-    std::ostream& _outstream;
+    void indexDeltas();
+
+    std::string _path;
+    std::unique_ptr<DeflateStreambuf> _zbuf;
+    std::ostream _outstream;
+    std::unique_ptr<Serializer> _serializer;
+    std::string _sendbuffer;
   };
 }
 
@@ -0,0 +1,304 @@
+//===-- cache.cpp - Retrieval Cache Source ----------------------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the implementation of the client-side cache
+/// kept in front of a backend's receive().
+///
+//===------------------------------------------------------------===//
+
+#include "cache.h"
+
+#include <fstream>
+#include <iterator>
+#include <cstdio>
+#include <cstdarg>
+#include <assert.h>
+
+#define FM_CACHE_MAGIC		0x31434d46 // "FMC1"
+
+film::CachedBackend::CachedBackend(std::unique_ptr<Backend> backend,
+				   size_t maxbytes,
+				   const std::string& cachefile)
+  :_backend(std::move(backend)), _maxbytes(maxbytes),
+   _cachefile(cachefile)
+{
+  assert(_backend);
+
+  flags = _backend->flags;
+
+  if (!_cachefile.empty())
+    load();
+}
+
+film::CachedBackend::~CachedBackend()
+{
+  if (!_cachefile.empty())
+    save();
+}
+
+void film::CachedBackend::send(std::vector<const char*>* v...)
+{
+  std::va_list args;
+
+  va_start(args, v);
+
+  std::vector<const char*>* varg = va_arg(args,
+					  std::vector<const char*>*);
+
+  va_end(args);
+
+  _backend->send(v, varg);
+}
+
+const char* film::CachedBackend::receive(const char* query)
+{
+  if ((flags & FM_BE_RECEIVE_ENABLED) == 0) {
+    return "";
+  }
+
+  assert(query);
+
+  std::string key = _backend->normalize(query);
+
+  // Taken before the fetch, so a change racing it leaves a stale
+  // stamp and costs a refetch rather than serving old results
+  uint64_t ver = _backend->version(key.c_str());
+  auto found = _index.find(key);
+
+  if (found != _index.end()) {
+    entry_iter it = found->second;
+
+    if (ver != 0 && it->version == ver) {
+      hits++;
+      _lru.splice(_lru.begin(), _lru, it);
+      resultbuffer = it->results;
+      return "";
+    }
+
+    erase(it);
+  }
+
+  misses++;
+  _backend->receive(key.c_str());
+
+  resultbuffer.clear();
+
+  for (const char* r : _backend->results())
+    resultbuffer.push_back(r);
+
+  // Without a version there is no telling when results go stale
+  if (ver != 0)
+    insert({ key, ver, resultbuffer, 0 });
+
+  return "";
+}
+
+void film::CachedBackend::connect()
+{
+  _backend->connect();
+}
+
+void film::CachedBackend::init()
+{
+  _backend->init();
+}
+
+void film::CachedBackend::flush()
+{
+  _backend->flush();
+}
+
+uint64_t film::CachedBackend::version(const char* query)
+{
+  return _backend->version(query);
+}
+
+std::string film::CachedBackend::normalize(const char* query) const
+{
+  return _backend->normalize(query);
+}
+
+std::unique_ptr<film::Cursor> film::CachedBackend::cursor(const char* query)
+{
+  return _backend->cursor(query);
+}
+
+void film::CachedBackend::update(const std::vector<uint64_t>& ids,
+				 const std::vector<size_t>& fields,
+				 const std::vector<const char*>& values)
+{
+  _backend->update(ids, fields, values);
+
+  // There is no telling which queries saw the records
+  invalidate();
+}
+
+void film::CachedBackend::invalidate()
+{
+  _index.clear();
+  _lru.clear();
+  _bytes = 0;
+}
+
+void film::CachedBackend::insert(Entry&& e)
+{
+  e.bytes = sizeof(Entry) + e.query.size();
+
+  for (const std::string& r : e.results)
+    e.bytes += sizeof(std::string) + r.size();
+
+  // An entry bigger than the whole budget would only flush the rest
+  if (e.bytes > _maxbytes)
+    return;
+
+  while (_bytes + e.bytes > _maxbytes)
+    erase(std::prev(_lru.end()));
+
+  _bytes += e.bytes;
+  _lru.push_front(std::move(e));
+  _index[_lru.front().query] = _lru.begin();
+}
+
+void film::CachedBackend::erase(entry_iter it)
+{
+  _bytes -= it->bytes;
+  _index.erase(it->query);
+  _lru.erase(it);
+}
+
+template<typename T>
+static bool readValue(std::istream& in, T& val)
+{
+  return (bool) in.read((char*) &val, sizeof(val));
+}
+
+/// Read a string, failing if its length is more than the left bytes
+/// of the file hold
+static bool readString(std::istream& in, std::string& s, uint64_t& left)
+{
+  uint32_t len;
+
+  if (left < sizeof(len) || !readValue(in, len))
+    return false;
+
+  left -= sizeof(len);
+
+  if (len > left)
+    return false;
+
+  s.resize(len);
+  left -= len;
+
+  return (bool) in.read(&s[0], len);
+}
+
+template<typename T>
+static void writeValue(std::ostream& out, T val)
+{
+  out.write((const char*) &val, sizeof(val));
+}
+
+static void writeString(std::ostream& out, const std::string& s)
+{
+  writeValue<uint32_t>(out, s.size());
+  out.write(s.data(), s.size());
+}
+
+/// Read the entries left by an earlier session
+///
+/// The file is a private cache in host byte order. Anything it holds
+/// is checked against the backend's version on first use, and a file
+/// that can't be read, or doesn't match its own lengths, is treated as
+/// empty.
+void film::CachedBackend::load()
+{
+  std::ifstream in(_cachefile, std::ios::binary | std::ios::ate);
+  uint64_t left = in ? (uint64_t) in.tellg() : 0;
+  uint32_t magic;
+  uint32_t count;
+
+  in.seekg(0);
+
+  if (left < sizeof(magic) + sizeof(count) || !readValue(in, magic)
+      || magic != FM_CACHE_MAGIC || !readValue(in, count))
+    return;
+
+  left -= sizeof(magic) + sizeof(count);
+
+  for (uint32_t i = 0; i < count; ++i) {
+    Entry e;
+    uint32_t nresults;
+
+    // Every length is checked against what is left of the file before
+    // anything is sized by it
+    if (!readString(in, e.query, left)
+	|| left < sizeof(e.version) + sizeof(nresults)
+	|| !readValue(in, e.version) || !readValue(in, nresults)) {
+      invalidate();
+      return;
+    }
+
+    left -= sizeof(e.version) + sizeof(nresults);
+
+    // Each result takes at least its length
+    if (nresults > left / sizeof(uint32_t)) {
+      invalidate();
+      return;
+    }
+
+    e.results.resize(nresults);
+
+    for (std::string& r : e.results) {
+      if (!readString(in, r, left)) {
+	invalidate();
+	return;
+      }
+    }
+
+    // Saved least recently used first, so the order is rebuilt
+    insert(std::move(e));
+  }
+
+  // A file longer than its entries was not written by save()
+  if (left != 0)
+    invalidate();
+}
+
+void film::CachedBackend::save()
+{
+  std::string tmpfile = _cachefile + ".tmp";
+
+  {
+    std::ofstream out(tmpfile, std::ios::binary | std::ios::trunc);
+
+    writeValue<uint32_t>(out, FM_CACHE_MAGIC);
+    writeValue<uint32_t>(out, _lru.size());
+
+    for (auto it = _lru.rbegin(); it != _lru.rend(); ++it) {
+      writeString(out, it->query);
+      writeValue<uint64_t>(out, it->version);
+      writeValue<uint32_t>(out, it->results.size());
+
+      for (const std::string& r : it->results)
+	writeString(out, r);
+    }
+
+    if (!out.flush()) {
+      out.close();
+      std::remove(tmpfile.c_str());
+      return;
+    }
+  }
+
+  // Replace the old cache whole so a crash never leaves half of one
+  std::rename(tmpfile.c_str(), _cachefile.c_str());
+}
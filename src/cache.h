@@ -0,0 +1,90 @@
+//===-- cache.h - Retrieval Cache Header ---------------* C++ *----===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the definition of the client-side cache kept in
+/// front of a backend's receive().
+///
+//===------------------------------------------------------------===//
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include "backend.h"
+
+#include <list>
+#include <unordered_map>
+
+namespace film {
+  /// Backend answering repeated queries from memory
+  ///
+  /// Results are kept per normalized query and evicted least recently
+  /// used first once their total size passes the budget. Each entry
+  /// carries the version the backend reported when it was filled; a
+  /// hit is only served while the backend still reports that version,
+  /// and a backend that reports none is never cached. With a
+  /// cache file the entries are loaded at startup and saved on
+  /// destruction. Sends and paged cursors pass straight through.
+  class CachedBackend :public Backend {
+  public:
+    CachedBackend(std::unique_ptr<Backend> backend,
+		  size_t maxbytes = 8 << 20,
+		  const std::string& cachefile = "");
+    virtual ~CachedBackend();
+
+    virtual void send(std::vector<const char*>* v...) override;
+    virtual const char* receive(const char* query) override;
+    virtual void connect() override;
+    virtual void init() override;
+    virtual void flush() override;
+    virtual uint64_t version(const char* query) override;
+    virtual std::string normalize(const char* query) const override;
+    virtual std::unique_ptr<Cursor> cursor(const char* query) override;
+    virtual void update(const std::vector<uint64_t>& ids,
+			const std::vector<size_t>& fields,
+			const std::vector<const char*>& values) override;
+
+    /// Drop every entry
+    void invalidate();
+
+    /// Backend the cache sits in front of
+    Backend& backend() { return *_backend; }
+
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+
+  private:
+    struct Entry {
+      std::string query;
+      uint64_t version;
+      std::vector<std::string> results;
+      size_t bytes;
+    };
+
+    typedef std::list<Entry>::iterator entry_iter;
+
+    void insert(Entry&& e);
+    void erase(entry_iter it);
+    void load();
+    void save();
+
+    std::unique_ptr<Backend> _backend;
+    size_t _maxbytes;
+    size_t _bytes = 0;
+    std::string _cachefile;
+
+    // Most recently used at the front
+    std::list<Entry> _lru;
+    std::unordered_map<std::string, entry_iter> _index;
+  };
+}
+
+#endif // #ifndef CACHE_H
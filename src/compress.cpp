@@ -0,0 +1,194 @@
+//===-- compress.cpp - Streaming Compression Source -------------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the implementation of the double-buffered
+/// gzip stream buffer.
+///
+//===------------------------------------------------------------===//
+
+#include "compress.h"
+
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <assert.h>
+
+film::DeflateStreambuf::DeflateStreambuf(std::streambuf* sink,
+					 int level,
+					 size_t blocksize)
+  :_sink(sink)
+{
+  assert(sink);
+  assert(blocksize > 0);
+
+  std::memset(&_zs, 0, sizeof(_zs));
+
+  // Window bits of 15 + 16 selects a gzip wrapper so the output can
+  // be read back with gzip(1) or gzopen()
+  if (deflateInit2(&_zs, level, Z_DEFLATED, 15 + 16, 8,
+		   Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw std::runtime_error("Failed to initialize compressor");
+  }
+
+  _blocks[0].resize(blocksize);
+  _blocks[1].resize(blocksize);
+  _zout.resize(deflateBound(&_zs, blocksize));
+
+  setp(_blocks[_cur].data(), _blocks[_cur].data() + blocksize);
+
+  _thread = std::thread(&DeflateStreambuf::worker, this);
+}
+
+film::DeflateStreambuf::~DeflateStreambuf()
+{
+  submit(Z_FINISH);
+  waitIdle();
+
+  {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _stop = true;
+  }
+
+  _cv.notify_all();
+  _thread.join();
+
+  deflateEnd(&_zs);
+  _sink->pubsync();
+}
+
+/// Hand the current block to the worker and switch to the other
+/// one, returning false once the sink has failed
+bool film::DeflateStreambuf::submit(int flush)
+{
+  std::unique_lock<std::mutex> lock(_mtx);
+
+  _cv.wait(lock, [this] { return !_busy; });
+
+  bool ok = !_failed;
+
+  _pending = _cur;
+  _pendinglen = pptr() - pbase();
+  _pendingflush = flush;
+  _busy = true;
+
+  lock.unlock();
+  _cv.notify_all();
+
+  _cur = _cur ^ 1;
+  setp(_blocks[_cur].data(), _blocks[_cur].data() + _blocks[_cur].size());
+
+  return ok;
+}
+
+bool film::DeflateStreambuf::waitIdle()
+{
+  std::unique_lock<std::mutex> lock(_mtx);
+  _cv.wait(lock, [this] { return !_busy; });
+
+  return !_failed;
+}
+
+void film::DeflateStreambuf::worker()
+{
+  std::unique_lock<std::mutex> lock(_mtx);
+
+  for (;;) {
+    _cv.wait(lock, [this] { return _busy || _stop; });
+
+    if (!_busy)
+      return;
+
+    // The block is ours until _busy is cleared, so compress it
+    // without holding the lock
+    lock.unlock();
+
+    _zs.next_in = (Bytef*) _blocks[_pending].data();
+    _zs.avail_in = _pendinglen;
+
+    bool failed = false;
+    int ret;
+
+    do {
+      _zs.next_out = (Bytef*) _zout.data();
+      _zs.avail_out = _zout.size();
+
+      ret = deflate(&_zs, _pendingflush);
+
+      if (ret == Z_STREAM_ERROR) {
+	failed = true;
+	break;
+      }
+
+      std::streamsize have = _zout.size() - _zs.avail_out;
+
+      if (have > 0 && _sink->sputn(_zout.data(), have) != have) {
+	failed = true;
+	break;
+      }
+    } while (_zs.avail_out == 0
+	     || (_pendingflush == Z_FINISH && ret != Z_STREAM_END));
+
+    if (!failed && _pendingflush == Z_SYNC_FLUSH)
+      _sink->pubsync();
+
+    lock.lock();
+    _failed = _failed || failed;
+    _busy = false;
+    _cv.notify_all();
+  }
+}
+
+film::DeflateStreambuf::int_type
+film::DeflateStreambuf::overflow(int_type ch)
+{
+  if (!submit(Z_NO_FLUSH))
+    return traits_type::eof();
+
+  if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+    *pptr() = traits_type::to_char_type(ch);
+    pbump(1);
+  }
+
+  return traits_type::not_eof(ch);
+}
+
+std::streamsize film::DeflateStreambuf::xsputn(const char* s,
+					       std::streamsize n)
+{
+  std::streamsize written = 0;
+
+  while (written < n) {
+    std::streamsize room = epptr() - pptr();
+
+    if (room == 0) {
+      if (traits_type::eq_int_type(overflow(traits_type::eof()),
+				   traits_type::eof()))
+	break;
+
+      continue;
+    }
+
+    std::streamsize len = std::min(room, n - written);
+    std::memcpy(pptr(), s + written, len);
+    pbump(len);
+    written += len;
+  }
+
+  return written;
+}
+
+int film::DeflateStreambuf::sync()
+{
+  submit(Z_SYNC_FLUSH);
+
+  return waitIdle() ? 0 : -1;
+}
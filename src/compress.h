@@ -0,0 +1,76 @@
+//===-- compress.h - Streaming Compression Header -----* C++ *----===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the definitions for the stream buffer used to
+/// compress backend output on a worker thread.
+///
+//===------------------------------------------------------------===//
+
+#ifndef COMPRESS_H
+#define COMPRESS_H
+
+#include <streambuf>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+#include <zlib.h>
+
+namespace film {
+  /// Stream buffer that gzip compresses everything written to it
+  /// and forwards the result to another stream buffer
+  ///
+  /// The caller fills one block while a worker thread compresses
+  /// and writes the other, so output is limited by compression
+  /// throughput instead of by the sink.
+  class DeflateStreambuf :public std::streambuf {
+  public:
+    DeflateStreambuf(std::streambuf* sink,
+		     int level = Z_DEFAULT_COMPRESSION,
+		     size_t blocksize = 1 << 20);
+    virtual ~DeflateStreambuf();
+
+    DeflateStreambuf(const DeflateStreambuf&) = delete;
+    DeflateStreambuf& operator=(const DeflateStreambuf&) = delete;
+
+  protected:
+    virtual int_type overflow(int_type ch) override;
+    virtual std::streamsize xsputn(const char* s,
+				   std::streamsize n) override;
+    virtual int sync() override;
+
+  private:
+    bool submit(int flush);
+    bool waitIdle();
+    void worker();
+
+    std::streambuf* _sink;
+    z_stream _zs;
+    std::vector<char> _blocks[2];
+    std::vector<char> _zout;
+    uint8_t _cur = 0;
+
+    std::mutex _mtx;
+    std::condition_variable _cv;
+    bool _busy = false;	// Worker owns the pending block
+    bool _stop = false;
+    bool _failed = false;
+    uint8_t _pending = 0;
+    size_t _pendinglen = 0;
+    int _pendingflush = Z_NO_FLUSH;
+
+    std::thread _thread;
+  };
+}
+
+#endif // #ifndef COMPRESS_H
@@ -0,0 +1,315 @@
+//===-- fanout.cpp - Multi-Backend Dispatch Source --------------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the implementation of concurrent dispatch to
+/// multiple backends.
+///
+//===------------------------------------------------------------===//
+
+#include "fanout.h"
+
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <cstdarg>
+#include <assert.h>
+
+/// Counts down as lanes finish a dispatched call
+struct Latch {
+  std::mutex mtx;
+  std::condition_variable cv;
+  size_t remaining;
+  size_t failures = 0;
+  std::string lasterror;
+
+  Latch(size_t n) :remaining(n) {}
+
+  void done(const char* error)
+  {
+    std::lock_guard<std::mutex> lock(mtx);
+
+    if (error) {
+      failures++;
+      lasterror = error;
+    }
+
+    if (--remaining == 0)
+      cv.notify_all();
+  }
+
+  void wait()
+  {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this] { return remaining == 0; });
+  }
+};
+
+film::FanoutBackend::FanoutBackend(std::vector<std::unique_ptr<Backend>>
+				   backends)
+{
+  assert(!backends.empty());
+
+  for (std::unique_ptr<Backend>& be : backends) {
+    assert(be);
+
+    flags = flags | (be->flags & FM_BE_RECEIVE_ENABLED);
+
+    _lanes.emplace_back(new Lane);
+    _lanes.back()->backend = std::move(be);
+  }
+
+  for (std::unique_ptr<Lane>& lane : _lanes)
+    lane->thread = std::thread(&FanoutBackend::run, this, std::ref(*lane));
+}
+
+film::FanoutBackend::~FanoutBackend()
+{
+  for (std::unique_ptr<Lane>& lane : _lanes) {
+    {
+      std::lock_guard<std::mutex> lock(lane->mtx);
+      lane->stop = true;
+    }
+
+    lane->cv.notify_all();
+  }
+
+  for (std::unique_ptr<Lane>& lane : _lanes)
+    lane->thread.join();
+}
+
+void film::FanoutBackend::run(Lane& lane)
+{
+  std::unique_lock<std::mutex> lock(lane.mtx);
+
+  for (;;) {
+    lane.cv.wait(lock, [&lane] { return lane.stop || !lane.queue.empty(); });
+
+    if (lane.queue.empty())
+      return;
+
+    task fn = std::move(lane.queue.front());
+    lane.queue.pop_front();
+
+    lock.unlock();
+    fn(*lane.backend);
+    lock.lock();
+  }
+}
+
+/// Run fn on every backend at once and wait for all of them
+void film::FanoutBackend::dispatch(const task& fn, const char* what,
+				   bool issend)
+{
+  std::shared_ptr<Latch> latch(new Latch(_lanes.size()));
+
+  for (std::unique_ptr<Lane>& l : _lanes) {
+    Lane* lane = l.get();
+
+    task wrapped = [fn, latch, lane, issend](Backend& be) {
+      auto start = std::chrono::steady_clock::now();
+      std::string error;
+
+      try {
+	fn(be);
+      }
+      catch (std::exception& e) {
+	error = e.what();
+      }
+
+      std::chrono::duration<double> elapsed =
+	std::chrono::steady_clock::now() - start;
+
+      if (issend) {
+	lane->sends++;
+	lane->sendtotal += elapsed.count();
+	lane->sendmax = std::max(lane->sendmax, elapsed.count());
+      }
+
+      if (!error.empty()) {
+	lane->failures++;
+	lane->lasterror = error;
+      }
+
+      latch->done(error.empty() ? nullptr : error.c_str());
+    };
+
+    {
+      std::lock_guard<std::mutex> lock(lane->mtx);
+      lane->queue.push_back(std::move(wrapped));
+    }
+
+    lane->cv.notify_all();
+  }
+
+  latch->wait();
+
+  if (latch->failures == _lanes.size()) {
+    throw std::runtime_error(std::string("All backends failed to ")
+			     + what + ": " + latch->lasterror);
+  }
+}
+
+void film::FanoutBackend::send(std::vector<const char*>* v...)
+{
+  std::va_list args;
+
+  assert(v);
+
+  va_start(args, v);
+
+  std::vector<const char*>* varg = va_arg(args,
+					  std::vector<const char*>*);
+
+  assert(varg);
+
+  va_end(args);
+
+  // The caller's vectors outlive the dispatch, so lanes can share
+  // them without copying
+  dispatch([v, varg](Backend& be) { be.send(v, varg); }, "send", true);
+}
+
+const char* film::FanoutBackend::receive(const char* query)
+{
+  if ((flags & FM_BE_RECEIVE_ENABLED) == 0) {
+    return "";
+  }
+
+  // Read from the first backend able to answer, on its own thread
+  for (std::unique_ptr<Lane>& lane : _lanes) {
+    if ((lane->backend->flags & FM_BE_RECEIVE_ENABLED) == 0)
+      continue;
+
+    std::shared_ptr<Latch> latch(new Latch(1));
+    std::vector<std::string> results;
+    std::string error;
+
+    {
+      std::lock_guard<std::mutex> lock(lane->mtx);
+
+      lane->queue.push_back([&, latch](Backend& be) {
+	try {
+	  be.receive(query);
+
+	  for (const char* r : be.results())
+	    results.push_back(r);
+	}
+	catch (std::exception& e) {
+	  error = e.what();
+	}
+
+	latch->done(nullptr);
+      });
+    }
+
+    lane->cv.notify_all();
+    latch->wait();
+
+    if (!error.empty())
+      throw std::runtime_error(error);
+
+    resultbuffer = std::move(results);
+    break;
+  }
+
+  return "";
+}
+
+void film::FanoutBackend::connect()
+{
+  dispatch([](Backend& be) { be.connect(); }, "connect");
+}
+
+void film::FanoutBackend::init()
+{
+  dispatch([](Backend& be) { be.init(); }, "init");
+}
+
+void film::FanoutBackend::flush()
+{
+  dispatch([](Backend& be) { be.flush(); }, "flush");
+}
+
+/// First backend able to answer receive(), if any
+film::Backend* film::FanoutBackend::receiver() const
+{
+  for (const std::unique_ptr<Lane>& lane : _lanes) {
+    if ((lane->backend->flags & FM_BE_RECEIVE_ENABLED) != 0)
+      return lane->backend.get();
+  }
+
+  return nullptr;
+}
+
+// Lanes sit idle between dispatches, so these are safe to call on
+// the receiving backend directly
+uint64_t film::FanoutBackend::version(const char* query)
+{
+  Backend* be = receiver();
+
+  return be ? be->version(query) : 0;
+}
+
+std::string film::FanoutBackend::normalize(const char* query) const
+{
+  Backend* be = receiver();
+
+  return be ? be->normalize(query) : Backend::normalize(query);
+}
+
+std::unique_ptr<film::Cursor> film::FanoutBackend::cursor(const char* query)
+{
+  Backend* be = receiver();
+
+  return be ? be->cursor(query) : Backend::cursor(query);
+}
+
+void film::FanoutBackend::update(const std::vector<uint64_t>& ids,
+				 const std::vector<size_t>& fields,
+				 const std::vector<const char*>& values)
+{
+  dispatch([&](Backend& be) { be.update(ids, fields, values); }, "update");
+}
+
+uint64_t film::FanoutBackend::failures() const
+{
+  uint64_t n = 0;
+
+  for (const std::unique_ptr<Lane>& lane : _lanes)
+    n += lane->failures;
+
+  return n;
+}
+
+void film::FanoutBackend::report(std::ostream& out,
+				 const std::vector<std::string>& names) const
+{
+  out << "Backend\tSends\tFailures\tMean ms\tMax ms\n";
+
+  for (size_t i = 0; i < _lanes.size(); ++i) {
+    const Lane& lane = *_lanes[i];
+    double mean = lane.sends ? lane.sendtotal / lane.sends : 0.0;
+
+    if (i < names.size())
+      out << names[i];
+    else
+      out << i;
+
+    out << '\t' << lane.sends << '\t' << lane.failures << '\t'
+	<< mean * 1e3 << '\t' << lane.sendmax * 1e3;
+
+    if (!lane.lasterror.empty())
+      out << "\t(" << lane.lasterror << ')';
+
+    out << '\n';
+  }
+}
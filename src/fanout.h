@@ -0,0 +1,90 @@
+//===-- fanout.h - Multi-Backend Dispatch Header ------* C++ *----===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the definition of the backend that forwards
+/// each record to several other backends at once.
+///
+//===------------------------------------------------------------===//
+
+#ifndef FANOUT_H
+#define FANOUT_H
+
+#include "backend.h"
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <functional>
+#include <condition_variable>
+
+namespace film {
+  /// Backend that dispatches to several backends concurrently
+  ///
+  /// Every backend gets its own worker thread and queue, so a call
+  /// takes as long as the slowest backend rather than the sum of all
+  /// of them. A backend that throws is counted as failed for that
+  /// call without affecting the others; the call itself only throws
+  /// if every backend failed.
+  class FanoutBackend :public Backend {
+  public:
+    FanoutBackend(std::vector<std::unique_ptr<Backend>> backends);
+    virtual ~FanoutBackend();
+
+    virtual void send(std::vector<const char*>* v...) override;
+    virtual const char* receive(const char* query) override;
+    virtual void connect() override;
+    virtual void init() override;
+    virtual void flush() override;
+    virtual uint64_t version(const char* query) override;
+    virtual std::string normalize(const char* query) const override;
+    virtual std::unique_ptr<Cursor> cursor(const char* query) override;
+    virtual void update(const std::vector<uint64_t>& ids,
+			const std::vector<size_t>& fields,
+			const std::vector<const char*>& values) override;
+
+    /// Calls failed so far, summed over every backend. A call that
+    /// raises it was missed by at least one.
+    uint64_t failures() const;
+
+    /// Print call counts, failures and send latency per backend,
+    /// labelled by names if given
+    void report(std::ostream& out,
+		const std::vector<std::string>& names = {}) const;
+
+  private:
+    typedef std::function<void(Backend&)> task;
+
+    struct Lane {
+      std::unique_ptr<Backend> backend;
+      std::thread thread;
+      std::mutex mtx;
+      std::condition_variable cv;
+      std::deque<task> queue;
+      bool stop = false;
+
+      // Only touched by the lane's thread until the lane is idle
+      uint64_t sends = 0;
+      uint64_t failures = 0;
+      double sendtotal = 0.0;
+      double sendmax = 0.0;
+      std::string lasterror;
+    };
+
+    void run(Lane& lane);
+    Backend* receiver() const;
+    void dispatch(const task& fn, const char* what, bool issend = false);
+
+    std::vector<std::unique_ptr<Lane>> _lanes;
+  };
+}
+
+#endif // #ifndef FANOUT_H
@@ -6,6 +6,7 @@
  */
 
 #include "fields_magic.h"
+#include "stats.h"
 
 #include <ncurses.h>
 #include <form.h>
@@ -38,6 +39,13 @@ static MENU* menu;
 static ITEM** items;
 static WINDOW* win_menu;
 
+/* Browse globals */
+static WINDOW* win_browse;
+
+#define FM_BROWSE_ROWS		18
+#define FM_BROWSE_COLS		76
+#define FM_BROWSE_NUMW		9
+
 /* Sample autocomplete strings for testing */
 char* sample_ac_name[] = {
 	"Sample 1",
@@ -116,6 +124,29 @@ static void pagenum_update()
 	pos_form_cursor(form);
 }
 
+/* Allocate the array of fields for populateFields() */
+int allocateFields(unsigned int _numfields)
+{
+	fields = malloc((_numfields * 2 + 1) * sizeof(FIELD*));
+	if (fields == NULL) {
+		/* return error if malloc fails */
+		fprintf(stderr, "Out of memory\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+/* Free fields made by populateFields() and the array holding them */
+void freeFields(unsigned int _numfields)
+{
+	for (unsigned int i = 0; i < 2 * _numfields; ++i)
+		free_field(fields[i]);
+
+	free(fields);
+	fields = NULL;
+}
+
 /* Populate fields with the given parameters */
 int populateFields(struct formdata* _formdata,
 		   unsigned int _numfields)
@@ -125,7 +156,7 @@ int populateFields(struct formdata* _formdata,
 	int pageno = 1;
 
 	/* Create required fields */
-	for (uint8_t i = 0; i < 2 * _numfields; i = i + 2) {
+	for (unsigned int i = 0; i < 2 * _numfields; i = i + 2) {
 		/* Use two rows of film and set offset width */
 		fields[i] = new_field(1, 15, i + 1, 0, 0, 0);
 		fields[i+1] = new_field(1, 40, i + 1, 20, 0, 0);
@@ -144,6 +175,11 @@ int populateFields(struct formdata* _formdata,
 		/* Underline entry forms */
 		set_field_back(fields[i + 1], A_UNDERLINE);
 
+		/* Scroll entries wider than the field, up to the buffer */
+		field_opts_off(fields[i + 1], O_STATIC);
+		set_max_field(fields[i + 1],
+			      sizeof(_formdata[i/2].data) - 1);
+
 		/* Assign user pointer to formdata for autocomplete */
 		set_field_userptr(fields[i+1], &_formdata[i/2]);
 
@@ -414,9 +450,155 @@ int mdriver(int ch)
 	return 0;
 }
 
+/* Draw _s from column _hscroll at line _y of the browse window */
+static void browse_line(int _y, const char* _s, size_t _hscroll)
+{
+	if (_hscroll < strlen(_s))
+		mvwaddnstr(win_browse, _y, 1 + FM_BROWSE_NUMW, _s + _hscroll,
+			   FM_BROWSE_COLS - FM_BROWSE_NUMW);
+}
+
+/* Redraw the page of rows starting at _top */
+static void browse_draw(const char* _header, size_t _top, size_t _nrows,
+			const char** _rows, size_t _total, size_t _hscroll)
+{
+	move(2, 2);
+	clrtoeol();
+
+	if (_nrows == 0)
+		printw("No rows");
+	else if (_total == SIZE_MAX)
+		printw("Rows %zu-%zu", _top + 1, _top + _nrows);
+	else
+		printw("Rows %zu-%zu of %zu", _top + 1, _top + _nrows, _total);
+
+	werase(win_browse);
+	box(win_browse, 0, 0);
+
+	wattron(win_browse, A_BOLD);
+	browse_line(1, _header, _hscroll);
+	wattroff(win_browse, A_BOLD);
+
+	for (size_t i = 0; i < _nrows; ++i) {
+		mvwprintw(win_browse, i + 2, 1, "%*zu ", FM_BROWSE_NUMW - 1,
+			  _top + i + 1);
+		browse_line(i + 2, _rows[i], _hscroll);
+	}
+
+	refresh();
+	wrefresh(win_body);
+	wrefresh(win_browse);
+}
+
+/* Show rows from _fetch a page at a time until F1 */
+int browseRecords(const char* _title, const char* _header,
+		  fm_fetch_fn _fetch, void* _ctx)
+{
+	const char* rows[FM_BROWSE_ROWS];
+	size_t top = 0;
+	size_t hscroll = 0;
+	size_t total = SIZE_MAX;
+	size_t nrows;
+	int ch;
+
+	assert(_header);
+	assert(_fetch);
+
+	initscr();
+	noecho();
+	cbreak();
+	keypad(stdscr, TRUE);
+	curs_set(0);
+
+	win_body = newwin(25, 80, 0, 0);
+	assert(win_body != NULL);
+	box(win_body, 0, 0);
+	win_browse = derwin(win_body, 21, 78, 3, 1);
+	assert(win_browse != NULL);
+
+	mvwprintw(win_body, 1, 2, "F1: quit  %.60s", _title ? _title : "");
+	mvwprintw(win_body, 1, 59, "PAGE UP:   Prev Page");
+	mvwprintw(win_body, 2, 59, "PAGE DOWN: Next Page");
+
+	nrows = _fetch(_ctx, top, FM_BROWSE_ROWS, rows, &total);
+	browse_draw(_header, top, nrows, rows, total, hscroll);
+
+	while ((ch = getch()) != KEY_F(1)) {
+		uint64_t tstart = fm_stats_begin(FM_STAT_KEYSTROKE);
+		size_t prev = top;
+		int more = nrows == FM_BROWSE_ROWS
+			&& (total == SIZE_MAX || top + nrows < total);
+
+		switch (ch) {
+		case KEY_DOWN:
+			if (more)
+				top++;
+			break;
+
+		case KEY_UP:
+			if (top > 0)
+				top--;
+			break;
+
+		case KEY_NPAGE:
+			if (more)
+				top = top + FM_BROWSE_ROWS;
+			break;
+
+		case KEY_PPAGE:
+			top = top > FM_BROWSE_ROWS ? top - FM_BROWSE_ROWS : 0;
+			break;
+
+		case KEY_HOME:
+			top = 0;
+			break;
+
+		case KEY_END:
+			/* Reading past the end finds the total */
+			if (total == SIZE_MAX)
+				_fetch(_ctx, SIZE_MAX, 0, rows, &total);
+
+			if (total != SIZE_MAX)
+				top = total > FM_BROWSE_ROWS
+					? total - FM_BROWSE_ROWS : 0;
+			break;
+
+		case KEY_LEFT:
+			hscroll = hscroll > 8 ? hscroll - 8 : 0;
+			break;
+
+		case KEY_RIGHT:
+			hscroll = hscroll + 8;
+			break;
+
+		default:
+			break;
+		}
+
+		nrows = _fetch(_ctx, top, FM_BROWSE_ROWS, rows, &total);
+
+		/* A full last page only shows there is nothing after it */
+		if (nrows == 0 && top > 0) {
+			top = prev;
+			nrows = _fetch(_ctx, top, FM_BROWSE_ROWS, rows, &total);
+		}
+
+		browse_draw(_header, top, nrows, rows, total, hscroll);
+
+		fm_stats_end(FM_STAT_KEYSTROKE, tstart);
+	}
+
+	delwin(win_browse);
+	delwin(win_body);
+	endwin();
+
+	return 0;
+}
+
 int buildForm(struct formdata* _formdata, uint8_t _numfields)
 {
 	int ch;
+	uint64_t tstart = fm_stats_begin(FM_STAT_FORM_BUILD);
 
 	initscr();
 	noecho();
@@ -435,12 +617,8 @@ int buildForm(struct formdata* _formdata, uint8_t _numfields)
 	mvwprintw(win_body, 2, 59,
 		  "PAGE DOWN: Next Page");
 
-	fields = malloc((_numfields * 2 + 1) * sizeof(FIELD*));
-	if (fields == NULL) {
-		/* return error if malloc fails */
-		fprintf(stderr, "Out of memory\n");
+	if (allocateFields(_numfields) != 0)
 		return 1;
-	}
 
 	/* Create required fields */
 	if (populateFields(_formdata, _numfields) != 0)
@@ -454,25 +632,29 @@ int buildForm(struct formdata* _formdata, uint8_t _numfields)
 	wrefresh(win_body);
 	wrefresh(win_form);
 
+	fm_stats_end(FM_STAT_FORM_BUILD, tstart);
+
 	/* Generate form and monitor key presses */
 	while ((ch = getch()) != KEY_F(1)) {
+		tstart = fm_stats_begin(FM_STAT_KEYSTROKE);
+
 		if ((ncurses_mode & FM_MODE_MENU) == FM_MODE_MENU)
 			mdriver(ch);
 		else
 			driver(ch, _formdata);
+
+		fm_stats_end(FM_STAT_KEYSTROKE, tstart);
 	}
 
 	/* Free all form information */
 	unpost_form(form);
 	free_form(form);
-	for (uint8_t i = 0; i < 2 * _numfields; ++i)
-		free_field(fields[i]);
 	delwin(win_form);
 	delwin(win_body);
 	endwin();
 
-	/* Free array of fields */
-	free(fields);
+	/* Free fields and the array holding them */
+	freeFields(_numfields);
 
 	return 0;
 }
@@ -2,6 +2,7 @@
 #define FIELDS_MAGIC_H
 
 #include <stdint.h>
+#include <stddef.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -9,13 +10,30 @@ extern "C" {
 
 struct formdata {
 	char		name[16];
-	char		data[64];
+	char		data[80];
 	char* const*	aclist;
 	uint16_t	naclist;
 };
 
 int buildForm(struct formdata* _formdata, uint8_t _numfields);
 
+/* Form construction steps used by buildForm(), exposed for benchmarks */
+int allocateFields(unsigned int _numfields);
+int populateFields(struct formdata* _formdata, unsigned int _numfields);
+void freeFields(unsigned int _numfields);
+
+/*
+ * Row source for browseRecords(): point rows at up to n rows from row
+ * on, valid until the next call, and return how many. Set total to
+ * the number of rows once known, or SIZE_MAX.
+ */
+typedef size_t (*fm_fetch_fn)(void* ctx, size_t row, size_t n,
+			      const char** rows, size_t* total);
+
+/* Page through rows from _fetch below a _header row of column names */
+int browseRecords(const char* _title, const char* _header,
+		  fm_fetch_fn _fetch, void* _ctx);
+
 #ifdef __cplusplus
 }
 #endif /* #ifdef __cplusplus */
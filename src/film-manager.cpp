@@ -15,16 +15,35 @@
 ///
 //===------------------------------------------------------------===//
 
+#include "app.h"
 #include "fields_magic.h"
 #include "backend.h"
+#include "scan.h"
+#include "watch.h"
+#include "fanout.h"
+#include "shm.h"
+#include "cache.h"
+#include "shard.h"
+#include "store.h"
+#include "stats.h"
 
 #include <vector>
+#include <algorithm>
 #include <string>
+#include <set>
 #include <cstring>
+#include <cstdlib>
+#include <cerrno>
+#include <cctype>
+#include <cstdint>
 #include <utility>
 #include <iostream>
+#include <memory>
 #include <assert.h>
 #include <getopt.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 // Bring in variables from getopt library
 extern char *optarg;
@@ -33,87 +52,8 @@ extern int optopt;
 extern int opterr;
 extern int optreset;
 
-// Program operating modes
-#define FM_OP_USAGE		0x01
-#define FM_OP_VERSION		0x02
-#define FM_OP_INTERACTIVE	0x04
-#define FM_OP_BE_TEXT		0x07
-
-/// Class to store application global variables and methods
-class App {
-public:
-  typedef std::vector<std::vector<const char*>> acvector;
-  acvector aclist;
-  std::string acfile;
-} app;
-
-/// Generate autocomplete information
-App::acvector autoCompleteLists(film::Backend& _be,
-				uint8_t& _modereg,
-				size_t len)
-{
-  std::vector<std::vector<const char*>> _aclist;
-
-  if ((_modereg & FM_OP_BE_TEXT) == FM_OP_BE_TEXT) {
-    if (!app.acfile.empty()) {
-      try {
-	_be.receive(app.acfile.c_str());
-      }
-      catch (std::exception& e) {
-	std::cerr << "Failed to receive autocomplete info with error "
-		  << e.what();
-	exit(1);
-      }
-
-      _aclist.assign(len, _be.results());
-    }
-  }
-
-  return _aclist;
-}
-
-/// Generate the list of fields to fill out
-void generateFields(std::vector<formdata>& _formdata,
-		    const std::vector<const char*>& _labels)
-{
-  // Copy labels to formdata struct
-  for (uint16_t i = 0; i < _labels.size(); ++i) {
-    _formdata.push_back(formdata());
-    formdata& fd = _formdata.back();
-    fd = {
-      .name = "",
-      .data = "",
-      .aclist = NULL,
-      .naclist = 0
-    };
-
-    if (!app.aclist.empty()) {
-      fd.aclist = (char* const*) &app.aclist.at(i)[0];
-      fd.naclist = app.aclist[i].size();
-    }
-
-    strncpy(fd.name, _labels[i], sizeof(fd.name)/sizeof(char));
-  }
-}
-
-/// Export field information to backend
-int processFields(film::Backend& _backend,
-		  const std::vector<formdata>& _fd)
-{
-  std::vector<const char*> labels;
-  std::vector<const char*> datas;
-
-  assert(_fd.size() > 0);
-
-  for (uint16_t i = 0; i < _fd.size(); ++i) {
-    labels.push_back(_fd[i].name);
-    datas.push_back(_fd[i].data);
-  }
-
-  _backend.send(&labels, &datas);
-
-  return 0;
-}
+/// Set by SIGINT and SIGTERM to end watch mode cleanly
+static volatile sig_atomic_t stopRequested = 0;
 
 int printUsage(int _argc, const char** _argv,
 	       std::ostream& out = std::cout)
@@ -121,7 +61,12 @@ int printUsage(int _argc, const char** _argv,
   assert(_argc > 0);
 
   out << "Usage:\n"
-      << _argv[0] << " [ -i | --interactive ] [ -b | --backend name ]\n"
+      << _argv[0] << " [ -i | --interactive ] [ -b | --backend name ]...\n"
+      << _argv[0] << " -s | --scan directory [ -i ]\n"
+      << _argv[0] << " -w | --watch directory [ -c | --cursor-file file ]\n"
+      << _argv[0] << " -B | --browse query [ -b | --backend name ]...\n"
+      << _argv[0] << " -u | --update statement -b text:filename\n"
+      << _argv[0] << " --serve-shm name [ -b | --backend name ]...\n"
       << _argv[0] << " -h | --help\n"
       << _argv[0] << " -V | --version \n"
       << '\n'
@@ -129,15 +74,60 @@ int printUsage(int _argc, const char** _argv,
       << "-i | --interactive\t\t\tRun in interactive mode\n"
       << "\t\t\t\t\t(Default)\n"
       << "-b | --backend name\t\t\tName of data backend to\n"
-      << "\t\t\t\t\tuse (Default text)\n"
+      << "\t\t\t\t\tuse (Default text), repeat\n"
+      << "\t\t\t\t\tto write to several at once\n"
       << "-a | --auto-complete-file filename\tFile to look\n"
       << "\t\t\t\t\tfor auto-complete list\n"
+      << "-z | --compress level\t\t\tGzip backend output at\n"
+      << "\t\t\t\t\tlevel 1-9 (Default off)\n"
+      << "-f | --format name\t\t\tRecord output format\n"
+      << "\t\t\t\t\t(Default json)\n"
+      << "-s | --scan directory\t\t\tRecord every TIFF and JPEG\n"
+      << "\t\t\t\t\tscan below directory, with\n"
+      << "\t\t\t\t\t-i review each in the form\n"
+      << "-w | --watch directory\t\t\tRecord scans as they are\n"
+      << "\t\t\t\t\twritten to directory\n"
+      << "-c | --cursor-file file\t\t\tList of files already\n"
+      << "\t\t\t\t\trecorded by --watch\n"
+      << "-B | --browse query\t\t\tPage through the results\n"
+      << "\t\t\t\t\tof query, a record file for\n"
+      << "\t\t\t\t\tthe text backend\n"
+      << "-u | --update statement\t\t\tChange records matching\n"
+      << "\t\t\t\t\t\"where Field = value set\n"
+      << "\t\t\t\t\tField = value, ...\", saving\n"
+      << "\t\t\t\t\tonly the changed fields\n"
+      << "--serve-shm name\t\t\tReceive records from shm:name\n"
+      << "\t\t\t\t\tclients on this host and\n"
+      << "\t\t\t\t\tsave them to the backend\n"
+      << "-S | --stats\t\t\t\tPrint latency statistics\n"
+      << "\t\t\t\t\ton exit\n"
+      << "--cache-size megabytes\t\t\tMemory for caching lookups\n"
+      << "\t\t\t\t\t(Default 8, 0 disables)\n"
+      << "--cache-file file\t\t\tKeep cached lookups in file\n"
+      << "\t\t\t\t\tbetween sessions\n"
+      << "-T | --trace filename\t\t\tWrite Chrome trace events\n"
+      << "\t\t\t\t\tto filename on exit\n"
       << "-V | --version\t\t\t\tPrint version information\n"
       << "\t\t\t\t\tand exit\n"
       << "-h | --help\t\t\t\tPrint this help message\n"
       << '\n'
       << "Available Backend Handlers:\n"
-      << "text\n";
+      << "text\t\t\t\t\tStandard output\n"
+      << "text:filename\t\t\t\tFile, appending\n"
+      << "shm:name\t\t\t\tLocal --serve-shm server,\n"
+      << "\t\t\t\t\tqueried through it, or text\n"
+      << "\t\t\t\t\tif none is running\n"
+      << "shard:directory\t\t\t\tOne NDJSON file per year,\n"
+      << "\t\t\t\t\tqueried by date range such\n"
+      << "\t\t\t\t\tas 1965..1970-06\n"
+      << "mem\t\t\t\t\tIn-memory store, only for a\n"
+      << "\t\t\t\t\t--serve-shm server; clients\n"
+      << "\t\t\t\t\tquery it by Field=value\n"
+      << '\n'
+      << "Available Formats:\n";
+
+  for (const char* const* f = film::serializerNames; *f; ++f)
+    out << *f << '\n';
 
   return 0;
 }
@@ -169,6 +159,439 @@ int runInteractive(std::vector<formdata>& _formdata,
   return 0;
 }
 
+/// Record each scan, in the form first if interactive mode was
+/// requested, adding the paths of those saved to _recorded if given.
+/// With _fanout, a scan is only saved once every backend has it.
+int recordScans(film::Backend& _be,
+		const std::vector<const char*>& _labels,
+		const std::vector<film::ScanInfo>& _scans,
+		uint8_t _modereg,
+		std::vector<std::string>* _recorded = nullptr,
+		const film::FanoutBackend* _fanout = nullptr)
+{
+  // Scan fields are the trailing labels
+  size_t offset = _labels.size() - film::scanLabels.size();
+
+  for (const film::ScanInfo& si : _scans) {
+    if (!si.error.empty()) {
+      std::cerr << "Skipping " << si.path << ": " << si.error << '\n';
+      continue;
+    }
+
+    std::vector<formdata> fd;
+    std::vector<std::string> values = film::scanValues(si);
+
+    generateFields(fd, _labels);
+
+    for (size_t i = 0; i < values.size(); ++i) {
+      strncpy(fd[offset + i].data, values[i].c_str(),
+	      sizeof(fd[offset + i].data) - 1);
+    }
+
+    if ((_modereg & FM_OP_INTERACTIVE) == FM_OP_INTERACTIVE
+	&& buildForm(&fd[0], fd.size()) != 0) {
+      std::cerr << "Form interface ended in complete failure" << '\n';
+      return 1;
+    }
+
+    std::vector<const char*> keys;
+    std::vector<const char*> datas;
+
+    for (const formdata& f : fd) {
+      keys.push_back(f.name);
+      datas.push_back(f.data);
+    }
+
+    // Values cut to fit the form, such as long paths, are saved whole
+    // unless they were edited in it
+    for (size_t i = 0; i < values.size(); ++i) {
+      const char* cut = fd[offset + i].data;
+      size_t room = sizeof(fd[offset + i].data) - 1;
+
+      if (values[i].size() > room && strlen(cut) == room
+	  && values[i].compare(0, room, cut) == 0)
+	datas[offset + i] = values[i].c_str();
+    }
+
+    uint64_t failures = _fanout ? _fanout->failures() : 0;
+
+    _be.send(&keys, &datas);
+
+    if (_recorded && (!_fanout || _fanout->failures() == failures))
+      _recorded->push_back(si.path);
+  }
+
+  return 0;
+}
+
+/// Checksum and measure every scan file below the scan directory
+int runScan(film::Backend& _be,
+	    const std::vector<const char*>& _labels,
+	    uint8_t _modereg)
+{
+  std::vector<std::string> paths;
+
+  try {
+    paths = film::listScanFiles(app.scandir);
+  }
+  catch (std::exception& e) {
+    std::cerr << "Failed to read scan directory with error "
+	      << e.what() << '\n';
+    return 1;
+  }
+
+  return recordScans(_be, _labels, film::scanFiles(paths), _modereg);
+}
+
+static void handleStop(int)
+{
+  stopRequested = 1;
+}
+
+/// Record scans as they land in the watch directory until signalled
+int runWatch(film::Backend& _be,
+	     const std::vector<const char*>& _labels,
+	     const film::FanoutBackend* _fanout)
+{
+  struct sigaction sa = {};
+
+  // No SA_RESTART, so a signal interrupts the wait for files
+  sa.sa_handler = handleStop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  if (app.cursorfile.empty())
+    app.cursorfile = app.scandir + "/.film-manager-cursor";
+
+  try {
+    film::WatchFolder watch(app.scandir, app.cursorfile);
+
+    while (!stopRequested) {
+      std::vector<std::string> batch = watch.wait(1000);
+
+      if (batch.empty())
+	continue;
+
+      std::vector<std::string> recorded;
+
+      if (recordScans(_be, _labels, film::scanFiles(batch), 0,
+		      &recorded, _fanout) != 0)
+	return 1;
+
+      uint64_t failures = _fanout ? _fanout->failures() : 0;
+
+      // Records must be out before the cursor says they are, and
+      // files that failed, on any backend, are left to be retried
+      // when they change
+      _be.flush();
+
+      if (!_fanout || _fanout->failures() == failures)
+	watch.commit(recorded);
+    }
+  }
+  catch (std::exception& e) {
+    std::cerr << "Watch failed with error " << e.what() << '\n';
+    return 1;
+  }
+
+  return 0;
+}
+
+/// Report collected statistics at exit, whichever mode ran
+static void reportStats()
+{
+  if (!app.tracefile.empty()
+      && fm_stats_write_trace(app.tracefile.c_str()) != 0)
+    std::cerr << "Failed to write trace to " << app.tracefile << '\n';
+
+  fm_stats_dump(stderr);
+}
+
+/// Save records from local shared memory clients, and answer their
+/// queries, until signalled
+int runServeShm(film::Backend& _be)
+{
+  struct sigaction sa = {};
+
+  sa.sa_handler = handleStop;
+  sigaction(SIGINT, &sa, NULL);
+  sigaction(SIGTERM, &sa, NULL);
+
+  try {
+    film::ShmServer server(app.shmserve, _be);
+    size_t dropped = 0;
+
+    while (!stopRequested) {
+      server.serve(500);
+
+      if (server.dropped() != dropped) {
+	dropped = server.dropped();
+	std::cerr << "Dropped malformed records from shared memory\n";
+      }
+    }
+  }
+  catch (std::exception& e) {
+    std::cerr << "Shared memory server failed with error " << e.what()
+	      << '\n';
+    return 1;
+  }
+
+  return 0;
+}
+
+// Width of a browse column, wide enough for its name
+#define FM_BROWSE_COLMIN	10
+#define FM_BROWSE_COLMAX	24
+
+/// Cursor, the columns laid out from the first record, and the last
+/// error for browseRecords() callbacks
+struct BrowseState {
+  std::unique_ptr<film::Cursor> cursor;
+  std::vector<std::string> columns;
+  std::vector<size_t> widths;
+  std::string header;
+  std::vector<std::string> lines;
+  std::string error;
+
+  /// Lay out a column for each field of the first record
+  void setColumns(const std::vector<std::string>& _keys);
+
+  /// Fixed-width line of the values of a record, by column name
+  std::string format(const char* _record) const;
+};
+
+/// Pad or cut s to width, with a gap before the next column
+static void appendColumn(std::string& _out, const std::string& _s,
+			 size_t _width)
+{
+  _out.append(_s, 0, _width);
+  _out.append(_width + 2 - std::min(_s.size(), _width), ' ');
+}
+
+void BrowseState::setColumns(const std::vector<std::string>& _keys)
+{
+  columns = _keys;
+  widths.clear();
+  header.clear();
+
+  for (const std::string& k : columns) {
+    widths.push_back(std::min(std::max(k.size(), (size_t) FM_BROWSE_COLMIN),
+			      (size_t) FM_BROWSE_COLMAX));
+    appendColumn(header, k, widths.back());
+  }
+}
+
+std::string BrowseState::format(const char* _record) const
+{
+  std::vector<std::string> keys;
+  std::vector<std::string> values;
+  std::string out;
+
+  if (!film::parseNdjson(_record, keys, values))
+    return "(not an ndjson record)";
+
+  for (size_t c = 0; c < columns.size(); ++c) {
+    auto it = std::find(keys.begin(), keys.end(), columns[c]);
+
+    appendColumn(out, it == keys.end() ? "" : values[it - keys.begin()],
+		 widths[c]);
+  }
+
+  return out;
+}
+
+static size_t fetchRows(void* _ctx, size_t _row, size_t _n,
+			const char** _rows, size_t* _total)
+{
+  BrowseState* bs = (BrowseState*) _ctx;
+  std::vector<const char*> rows;
+  size_t n = 0;
+
+  // Exceptions must not unwind through the ncurses code
+  try {
+    n = bs->cursor->fetch(_row, _n, rows);
+  }
+  catch (std::exception& e) {
+    bs->error = e.what();
+  }
+
+  bs->lines.resize(n);
+
+  for (size_t i = 0; i < n; ++i) {
+    bs->lines[i] = bs->format(rows[i]);
+    _rows[i] = bs->lines[i].c_str();
+  }
+
+  *_total = bs->cursor->size();
+
+  return n;
+}
+
+/// Page through the results of a query, a column per field
+int runBrowse(film::Backend& _be)
+{
+  BrowseState bs;
+
+  try {
+    std::vector<const char*> first;
+    std::vector<std::string> keys;
+    std::vector<std::string> values;
+
+    bs.cursor = _be.cursor(app.browsequery.c_str());
+
+    // Only one record per line can be paged through a row at a time
+    if (bs.cursor->fetch(0, 1, first) == 1) {
+      if (!film::parseNdjson(first[0], keys, values)) {
+	std::cerr << "Browse needs records in the ndjson format\n";
+	return 1;
+      }
+
+      bs.setColumns(keys);
+    }
+  }
+  catch (std::exception& e) {
+    std::cerr << "Failed to open results with error " << e.what() << '\n';
+    return 1;
+  }
+
+  if (browseRecords(app.browsequery.c_str(), bs.header.c_str(), fetchRows,
+		    &bs) != 0) {
+    std::cerr << "Browse interface ended in complete failure" << '\n';
+    return 1;
+  }
+
+  if (!bs.error.empty()) {
+    std::cerr << "Failed to read results with error " << bs.error << '\n';
+    return 1;
+  }
+
+  return 0;
+}
+
+/// Apply the bulk update statement to the records of the backend
+int runUpdate(film::Backend& _be)
+{
+  std::string query;
+
+  // Updates read back what the backend wrote, which only a file
+  // outlives this process to have
+  if (app.backends.size() == 1
+      && app.backends[0].compare(0, 5, "text:") == 0)
+    query = app.backends[0].substr(5);
+
+  if (query.empty()) {
+    std::cerr << "Updates need a single text:filename backend\n";
+    return 1;
+  }
+
+  try {
+    UpdateStatement us = parseUpdate(app.updatestmt);
+    std::vector<const char*> keys;
+    std::vector<const char*> values;
+
+    for (size_t i = 0; i < us.setkeys.size(); ++i) {
+      keys.push_back(us.setkeys[i].c_str());
+      values.push_back(us.setvalues[i].c_str());
+    }
+
+    size_t n = _be.updateWhere(query.c_str(), us.field.c_str(),
+			       us.value.c_str(), keys, values);
+    _be.flush();
+
+    std::cerr << "Updated " << n << " records\n";
+  }
+  catch (std::exception& e) {
+    std::cerr << "Failed to update records with error " << e.what()
+	      << '\n';
+    return 1;
+  }
+
+  return 0;
+}
+
+/// Identity of the file at path, or of standard output for NULL, to
+/// tell when two backends would write to the same one
+static std::string sinkIdentity(const char* _path)
+{
+  struct stat st;
+
+  if ((_path ? stat(_path, &st) : fstat(STDOUT_FILENO, &st)) != 0)
+    return _path ? _path : "stdout";
+
+  return std::to_string(st.st_dev) + ":" + std::to_string(st.st_ino);
+}
+
+/// Record that spec writes to sink, throwing if an earlier backend
+/// already does, as both would race on the same output
+static void claimSink(std::set<std::string>& _sinks, const std::string& _sink,
+		      const std::string& _spec)
+{
+  if (!_sinks.insert(_sink).second) {
+    throw std::runtime_error("Backend " + _spec
+			     + " writes to the same place as another");
+  }
+}
+
+/// Create the backend described by a --backend argument, adding where
+/// it writes to sinks
+std::unique_ptr<film::Backend> makeBackend(const std::string& _spec,
+					   std::set<std::string>& _sinks)
+{
+  std::ostream* out = &std::cout;
+  const char* path = NULL;
+  bool appending = false;
+
+  if (_spec.compare(0, 4, "shm:") == 0) {
+    claimSink(_sinks, _spec, _spec);
+
+    try {
+      return std::unique_ptr<film::Backend>(
+	new film::ShmBackend(_spec.substr(4)));
+    }
+    catch (std::exception& e) {
+      std::cerr << e.what() << ", falling back to text backend\n";
+      return makeBackend("text", _sinks);
+    }
+  }
+
+  if (_spec == "mem") {
+    claimSink(_sinks, _spec, _spec);
+    return std::unique_ptr<film::Backend>(new film::StoreBackend);
+  }
+
+  if (_spec.compare(0, 6, "shard:") == 0) {
+    std::unique_ptr<film::Backend> be(
+      new film::ShardedBackend(_spec.substr(6), app.compresslevel));
+
+    claimSink(_sinks, sinkIdentity(_spec.c_str() + 6), _spec);
+    return be;
+  }
+
+  if (_spec.compare(0, 5, "text:") == 0) {
+    path = _spec.c_str() + 5;
+    app.outfiles.emplace_back(path, std::ios::app);
+
+    if (app.outfiles.back().fail()) {
+      throw std::runtime_error("Failed to open " + _spec.substr(5));
+    }
+
+    out = &app.outfiles.back();
+
+    // A file already holding records has its header already
+    struct stat st;
+    appending = stat(path, &st) == 0 && st.st_size > 0;
+  }
+
+  // Opening the file created it, so it has an identity by now
+  claimSink(_sinks, sinkIdentity(path), _spec);
+
+  return std::unique_ptr<film::Backend>(
+    new film::TextBackend(*out, app.compresslevel,
+			  film::makeSerializer(app.format.c_str(),
+						appending),
+			  path));
+}
+
 int runParseOptions(int _argc, const char** _argv, uint8_t& _modereg)
 {
     // Read arguments
@@ -208,6 +631,90 @@ int runParseOptions(int _argc, const char** _argv, uint8_t& _modereg)
       .val = 'a'
     },
 
+    {
+      .name = "compress",
+      .has_arg = required_argument,
+      .flag = NULL,
+      .val = 'z'
+    },
+
+    {
+      .name = "format",
+      .has_arg = required_argument,
+      .flag = NULL,
+      .val = 'f'
+    },
+
+    {
+      .name = "scan",
+      .has_arg = required_argument,
+      .flag = NULL,
+      .val = 's'
+    },
+
+    {
+      .name = "watch",
+      .has_arg = required_argument,
+      .flag = NULL,
+      .val = 'w'
+    },
+
+    {
+      .name = "cursor-file",
+      .has_arg = required_argument,
+      .flag = NULL,
+      .val = 'c'
+    },
+
+    {
+      .name = "stats",
+      .has_arg = no_argument,
+      .flag = NULL,
+      .val = 'S'
+    },
+
+    {
+      .name = "trace",
+      .has_arg = required_argument,
+      .flag = NULL,
+      .val = 'T'
+    },
+
+    {
+      .name = "serve-shm",
+      .has_arg = required_argument,
+      .flag = NULL,
+      .val = 'M'
+    },
+
+    {
+      .name = "browse",
+      .has_arg = required_argument,
+      .flag = NULL,
+      .val = 'B'
+    },
+
+    {
+      .name = "update",
+      .has_arg = required_argument,
+      .flag = NULL,
+      .val = 'u'
+    },
+
+    {
+      .name = "cache-size",
+      .has_arg = required_argument,
+      .flag = NULL,
+      .val = 'Y'
+    },
+
+    {
+      .name = "cache-file",
+      .has_arg = required_argument,
+      .flag = NULL,
+      .val = 'K'
+    },
+
     {
       .name = NULL,
       .has_arg = 0,
@@ -219,7 +726,7 @@ int runParseOptions(int _argc, const char** _argv, uint8_t& _modereg)
   int ch;
 
   while ((ch = getopt_long(_argc, (char * const *) _argv,
-			   "hVib:a:", lopts, NULL)) != -1) {
+			   "hVib:a:z:f:s:w:c:ST:B:u:", lopts, NULL)) != -1) {
     switch (ch) {
 
     case 'h':
@@ -237,14 +744,26 @@ int runParseOptions(int _argc, const char** _argv, uint8_t& _modereg)
     case 'b':
       assert(optarg);
 
-      if (strcmp(optarg, "text") == 0) {
+      if (strcmp(optarg, "text") == 0 || strncmp(optarg, "text:", 5) == 0) {
 	_modereg = _modereg | FM_OP_BE_TEXT;
+	app.backends.push_back(optarg);
+	break;
+      }
+
+      if ((strncmp(optarg, "shm:", 4) == 0 && optarg[4] != '\0')
+	  || (strncmp(optarg, "shard:", 6) == 0 && optarg[6] != '\0')
+	  || strcmp(optarg, "mem") == 0) {
+	app.backends.push_back(optarg);
 	break;
       }
 
       std::cerr << "Backend handler " << optarg << " not found\n\n"
 		<< "Available backend handlers:\n"
-		<< "text\n";
+		<< "text\n"
+		<< "text:filename\n"
+		<< "shm:name\n"
+		<< "shard:directory\n"
+		<< "mem\n";
 
       exit(1);
 
@@ -253,6 +772,97 @@ int runParseOptions(int _argc, const char** _argv, uint8_t& _modereg)
       app.acfile = optarg;
       break;
 
+    case 'z':
+      assert(optarg);
+      app.compresslevel = atoi(optarg);
+
+      if (app.compresslevel < 1 || app.compresslevel > 9) {
+	std::cerr << "Compression level must be between 1 and 9\n";
+	exit(1);
+      }
+
+      break;
+
+    case 'f':
+      assert(optarg);
+
+      if (!film::makeSerializer(optarg)) {
+	std::cerr << "Format " << optarg << " not found\n";
+	exit(1);
+      }
+
+      app.format = optarg;
+      break;
+
+    case 's':
+      assert(optarg);
+      app.scandir = optarg;
+      _modereg = _modereg | FM_OP_SCAN;
+      break;
+
+    case 'w':
+      assert(optarg);
+      app.scandir = optarg;
+      _modereg = _modereg | FM_OP_SCAN | FM_OP_WATCH;
+      break;
+
+    case 'c':
+      assert(optarg);
+      app.cursorfile = optarg;
+      break;
+
+    case 'B':
+      assert(optarg);
+      app.browsequery = optarg;
+      _modereg = _modereg | FM_OP_BROWSE;
+      break;
+
+    case 'u':
+      assert(optarg);
+      app.updatestmt = optarg;
+      _modereg = _modereg | FM_OP_UPDATE;
+      break;
+
+    case 'M':
+      assert(optarg);
+      app.shmserve = optarg;
+      break;
+
+    case 'Y': {
+      assert(optarg);
+
+      char* end = NULL;
+      unsigned long mb;
+
+      errno = 0;
+      mb = strtoul(optarg, &end, 10);
+
+      // strtoul() skips blanks and negates "-1" into a huge size
+      if (!isdigit((unsigned char) optarg[0]) || *end != '\0'
+	  || errno == ERANGE || mb > (SIZE_MAX >> 20)) {
+	std::cerr << "Cache size must be a whole number of megabytes\n";
+	exit(1);
+      }
+
+      app.cachesize = (size_t) mb << 20;
+      break;
+    }
+
+    case 'K':
+      assert(optarg);
+      app.cachefile = optarg;
+      break;
+
+    case 'S':
+      app.statflags = app.statflags | FM_STATS_ENABLED;
+      break;
+
+    case 'T':
+      assert(optarg);
+      app.tracefile = optarg;
+      app.statflags = app.statflags | FM_STATS_ENABLED | FM_STATS_TRACE;
+      break;
+
     case '?':
       printUsage(_argc, _argv);
       exit(1);
@@ -266,18 +876,95 @@ int runParseOptions(int _argc, const char** _argv, uint8_t& _modereg)
   return 0;
 }
 
+/// Run whichever mode _modereg and the options ask for on _be
+int runModes(film::Backend& _be, uint8_t _modereg,
+	     std::vector<formdata>& _fd,
+	     std::vector<const char*>& _labels,
+	     const film::FanoutBackend* _fanout)
+{
+  if (!app.shmserve.empty()) {
+    int ret = runServeShm(_be);
+    return ret;
+  }
+
+  if ((_modereg & FM_OP_BROWSE) == FM_OP_BROWSE) {
+    int ret = runBrowse(_be);
+    return ret;
+  }
+
+  if ((_modereg & FM_OP_UPDATE) == FM_OP_UPDATE) {
+    int ret = runUpdate(_be);
+    return ret;
+  }
+
+  // Load autocomplete lists
+  app.aclist = autoCompleteLists(_be, _modereg, _labels.size());
+
+  if ((_modereg & FM_OP_WATCH) == FM_OP_WATCH) {
+    int ret = runWatch(_be, _labels, _fanout);
+    return ret;
+  }
+
+  if ((_modereg & FM_OP_SCAN) == FM_OP_SCAN) {
+    int ret = runScan(_be, _labels, _modereg);
+    return ret;
+  }
+
+  // If interactive mode is set, run ncurses form interface
+  if ((_modereg & FM_OP_INTERACTIVE) == FM_OP_INTERACTIVE) {
+    if (runInteractive(_fd, _labels) != 0) {
+      std::cerr << "Interactive failed\n";
+      return 1;
+    }
+  }
+
+  // Send data to backend
+  try {
+    if (processFields(_be, _fd) != 0) {
+      std::cerr << "Failed to process fields\n";
+      return 1;
+    }
+  }
+  catch (std::exception& e) {
+    std::cerr << "Failed to save record with error " << e.what() << '\n';
+    return 1;
+  }
+
+  return 0;
+}
+
 int main(int argc, const char** argv)
 {
   uint8_t modeReg = 0; // Registor to report active option flags
-  film::Backend* beptr = nullptr; // Ptr to set to desired backend
+  std::unique_ptr<film::Backend> be; // Desired backend
+  film::FanoutBackend* fanout = nullptr; // Owned by be, if any
   
 
   // Set program defaults
-  modeReg = modeReg | FM_OP_INTERACTIVE | FM_OP_BE_TEXT;
+  modeReg = modeReg | FM_OP_BE_TEXT;
 
   // Parse CLI arguments
   runParseOptions(argc, argv, modeReg);
 
+  // The store lives only as long as this process, so it must be
+  // serving other processes to be of any use
+  if (app.shmserve.empty()
+      && std::find(app.backends.begin(), app.backends.end(), "mem")
+      != app.backends.end()) {
+    std::cerr << "The mem backend needs --serve-shm name, "
+	      << "and clients use -b shm:name\n";
+    return 1;
+  }
+
+  if (app.statflags != 0) {
+    fm_stats_enable(app.statflags);
+    atexit(reportStats);
+  }
+
+  // Scan mode runs unattended unless -i was given
+  if ((modeReg & (FM_OP_SCAN | FM_OP_BROWSE | FM_OP_UPDATE)) == 0)
+    modeReg = modeReg | FM_OP_INTERACTIVE;
+
   // Temporary definitions for testing
   std::vector<formdata> fd;
   std::vector<const char*> labels = {
@@ -297,32 +984,50 @@ int main(int argc, const char** argv)
     }
   };
 
-  // Set up backend based on given args
-  if ((modeReg & FM_OP_BE_TEXT) == FM_OP_BE_TEXT)
-    beptr = new film::TextBackend;
+  if ((modeReg & FM_OP_SCAN) == FM_OP_SCAN) {
+    labels.insert(labels.end(), film::scanLabels.begin(),
+		  film::scanLabels.end());
+  }
 
-  // Load autocomplete lists
-  assert(beptr);
-  app.aclist = autoCompleteLists(*beptr, modeReg, labels.size());
+  // Set up backends based on given args, fanning out to all of them
+  // when more than one was asked for
+  if (app.backends.empty())
+    app.backends.push_back("text");
 
-  // If interactive mode is set, run ncurses form interface
-  if ((modeReg & FM_OP_INTERACTIVE) == FM_OP_INTERACTIVE) {
-    if (runInteractive(fd, labels) != 0) {
-      std::cerr << "Interactive failed\n";
-      return 1;
+  try {
+    std::set<std::string> sinks;
+
+    if (app.backends.size() == 1) {
+      be = makeBackend(app.backends[0], sinks);
     }
-  }
+    else {
+      std::vector<std::unique_ptr<film::Backend>> bes;
 
-  // Send data to backend
-  assert(beptr);
+      for (const std::string& spec : app.backends)
+	bes.push_back(makeBackend(spec, sinks));
 
-  if (processFields(*beptr, fd) != 0) {
-    std::cerr << "Failed to process fields\n";
+      fanout = new film::FanoutBackend(std::move(bes));
+      be.reset(fanout);
+    }
+  }
+  catch (std::exception& e) {
+    std::cerr << "Failed to set up backend with error " << e.what()
+	      << '\n';
     return 1;
   }
 
-  // Free memory
-  delete beptr;
+  // Repeated lookups are answered from memory
+  if (app.cachesize > 0) {
+    be.reset(new film::CachedBackend(std::move(be), app.cachesize,
+				     app.cachefile));
+  }
 
-  return 0;
+  assert(be);
+  int ret = runModes(*be, modeReg, fd, labels, fanout);
+
+  // Every mode's calls are counted, however it ended
+  if (fanout)
+    fanout->report(std::cerr, app.backends);
+
+  return ret;
 }
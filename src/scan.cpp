@@ -0,0 +1,358 @@
+//===-- scan.cpp - Scan File Inspection Source ------------------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the implementation of Scan Mode file
+/// inspection. Files are memory mapped so that hashing and header
+/// parsing read straight from the page cache.
+///
+//===------------------------------------------------------------===//
+
+#include "scan.h"
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <filesystem>
+#include <cstring>
+#include <cctype>
+#include <cerrno>
+#include <assert.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+const std::vector<const char*> film::scanLabels = {
+  "File",
+  "File Size",
+  "SHA-256",
+  "Image Format",
+  "Width",
+  "Height",
+  "Bit Depth",
+  "Channels"
+};
+
+std::vector<std::string> film::scanValues(const ScanInfo& info)
+{
+  return {
+    info.path,
+    std::to_string(info.size),
+    info.sha256,
+    info.format,
+    std::to_string(info.width),
+    std::to_string(info.height),
+    std::to_string(info.bitdepth),
+    std::to_string(info.channels)
+  };
+}
+
+bool film::isScanFile(const std::string& path)
+{
+  static const char* const exts[] = { ".tif", ".tiff", ".jpg", ".jpeg" };
+
+  std::string ext = std::filesystem::path(path).extension().string();
+  std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+
+  for (const char* e : exts) {
+    if (ext == e)
+      return true;
+  }
+
+  return false;
+}
+
+std::vector<std::string> film::listScanFiles(const std::string& dir)
+{
+  namespace fs = std::filesystem;
+
+  std::vector<std::string> paths;
+
+  for (const fs::directory_entry& de :
+	 fs::recursive_directory_iterator(dir)) {
+    if (de.is_regular_file() && isScanFile(de.path().string()))
+      paths.push_back(de.path().string());
+  }
+
+  std::sort(paths.begin(), paths.end());
+
+  return paths;
+}
+
+/// Bounds-checked reads from a mapped file in either byte order
+class ByteReader {
+public:
+  ByteReader(const uint8_t* data, size_t len, bool bigendian = false)
+    :_data(data), _len(len), _big(bigendian) {}
+
+  bool has(size_t off, size_t n) const
+  {
+    return off <= _len && n <= _len - off;
+  }
+
+  uint16_t u16(size_t off) const
+  {
+    if (!has(off, 2))
+      return 0;
+
+    const uint8_t* p = _data + off;
+    return _big ? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+  }
+
+  uint32_t u32(size_t off) const
+  {
+    if (!has(off, 4))
+      return 0;
+
+    const uint8_t* p = _data + off;
+
+    if (_big)
+      return ((uint32_t) p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+
+    return ((uint32_t) p[3] << 24) | (p[2] << 16) | (p[1] << 8) | p[0];
+  }
+
+private:
+  const uint8_t* _data;
+  size_t _len;
+  bool _big;
+};
+
+/// Read dimensions from the first IFD of a TIFF file
+static bool parseTiff(const uint8_t* data, size_t len,
+		      film::ScanInfo& info)
+{
+  if (len < 8)
+    return false;
+
+  bool big;
+
+  if (std::memcmp(data, "II*\0", 4) == 0)
+    big = false;
+  else if (std::memcmp(data, "MM\0*", 4) == 0)
+    big = true;
+  else
+    return false;
+
+  ByteReader r(data, len, big);
+  uint32_t ifd = r.u32(4);
+  uint16_t nentries = r.u16(ifd);
+
+  info.format = "TIFF";
+  info.bitdepth = 1;	// TIFF defaults when the tags are absent
+  info.channels = 1;
+
+  for (uint16_t i = 0; i < nentries; ++i) {
+    size_t entry = ifd + 2 + 12 * (size_t) i;
+
+    if (!r.has(entry, 12))
+      break;
+
+    uint16_t tag = r.u16(entry);
+    uint16_t type = r.u16(entry + 2);
+    uint32_t count = r.u32(entry + 4);
+
+    // SHORT values are left-justified in the value field, and arrays
+    // that don't fit in it are stored at the offset it holds
+    uint32_t value = type == 3 ? r.u16(entry + 8) : r.u32(entry + 8);
+
+    switch (tag) {
+    case 256:
+      info.width = value;
+      break;
+
+    case 257:
+      info.height = value;
+      break;
+
+    case 258:
+      if (type == 3 && count > 2)
+	value = r.u16(r.u32(entry + 8));
+
+      info.bitdepth = value;
+      break;
+
+    case 277:
+      info.channels = value;
+      break;
+
+    default:
+      break;
+    }
+  }
+
+  return true;
+}
+
+/// Read dimensions from the first start-of-frame segment of a JPEG
+static bool parseJpeg(const uint8_t* data, size_t len,
+		      film::ScanInfo& info)
+{
+  if (len < 4 || data[0] != 0xff || data[1] != 0xd8)
+    return false;
+
+  ByteReader r(data, len, true);
+  size_t off = 2;
+
+  info.format = "JPEG";
+
+  while (r.has(off, 4)) {
+    if (data[off] != 0xff)
+      return true;
+
+    uint8_t marker = data[off + 1];
+
+    // Fill bytes and markers without a length field
+    if (marker == 0xff) {
+      off += 1;
+      continue;
+    }
+
+    if (marker == 0x01 || (marker >= 0xd0 && marker <= 0xd9)) {
+      off += 2;
+      continue;
+    }
+
+    uint16_t seglen = r.u16(off + 2);
+
+    // SOF0-SOF15 except DHT, JPG and DAC
+    if (marker >= 0xc0 && marker <= 0xcf && marker != 0xc4
+	&& marker != 0xc8 && marker != 0xcc) {
+      if (!r.has(off + 4, 6))
+	return true;
+
+      info.bitdepth = data[off + 4];
+      info.height = r.u16(off + 5);
+      info.width = r.u16(off + 7);
+      info.channels = data[off + 9];
+
+      return true;
+    }
+
+    // Entropy-coded data follows SOS, so there is nothing left to read
+    if (marker == 0xda)
+      return true;
+
+    off += 2 + seglen;
+  }
+
+  return true;
+}
+
+static std::string sha256Hex(const uint8_t* data, size_t len)
+{
+  static const char hex[] = "0123456789abcdef";
+
+  unsigned char md[EVP_MAX_MD_SIZE];
+  unsigned int mdlen = 0;
+  std::string out;
+
+  if (EVP_Digest(data, len, md, &mdlen, EVP_sha256(), NULL) != 1)
+    return out;
+
+  out.reserve(2 * mdlen);
+
+  for (unsigned int i = 0; i < mdlen; ++i) {
+    out.push_back(hex[md[i] >> 4]);
+    out.push_back(hex[md[i] & 0xf]);
+  }
+
+  return out;
+}
+
+film::ScanInfo film::scanFile(const std::string& path)
+{
+  ScanInfo info;
+  struct stat st;
+
+  info.path = path;
+
+  int fd = open(path.c_str(), O_RDONLY);
+
+  if (fd < 0) {
+    info.error = std::strerror(errno);
+    return info;
+  }
+
+  if (fstat(fd, &st) != 0) {
+    info.error = std::strerror(errno);
+    close(fd);
+    return info;
+  }
+
+  info.size = st.st_size;
+
+  if (info.size == 0) {
+    close(fd);
+    info.sha256 = sha256Hex(NULL, 0);
+    return info;
+  }
+
+  void* map = mmap(NULL, info.size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    info.error = std::strerror(errno);
+    return info;
+  }
+
+  // The whole file is read front to back exactly once
+  madvise(map, info.size, MADV_SEQUENTIAL);
+  madvise(map, info.size, MADV_WILLNEED);
+
+  const uint8_t* data = (const uint8_t*) map;
+
+  if (!parseTiff(data, info.size, info))
+    parseJpeg(data, info.size, info);
+
+  info.sha256 = sha256Hex(data, info.size);
+
+  if (info.sha256.empty())
+    info.error = "Failed to compute checksum";
+
+  munmap(map, info.size);
+
+  return info;
+}
+
+std::vector<film::ScanInfo>
+film::scanFiles(const std::vector<std::string>& paths, unsigned nthreads)
+{
+  std::vector<ScanInfo> infos(paths.size());
+  std::atomic<size_t> next(0);
+
+  if (nthreads == 0)
+    nthreads = std::max(1u, std::thread::hardware_concurrency());
+
+  nthreads = std::min<size_t>(nthreads, paths.size());
+
+  // Files vary a lot in size, so threads pull the next path as they
+  // finish rather than taking fixed slices
+  auto work = [&]() {
+    for (size_t i = next++; i < paths.size(); i = next++)
+      infos[i] = scanFile(paths[i]);
+  };
+
+  std::vector<std::thread> threads;
+
+  for (unsigned i = 1; i < nthreads; ++i)
+    threads.emplace_back(work);
+
+  work();
+
+  for (std::thread& t : threads)
+    t.join();
+
+  return infos;
+}
@@ -0,0 +1,62 @@
+//===-- scan.h - Scan File Inspection Header ----------* C++ *----===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the definitions used by Scan Mode to checksum
+/// digital scans and read their image dimensions.
+///
+//===------------------------------------------------------------===//
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <vector>
+#include <string>
+#include <cstdint>
+
+namespace film {
+  /// Metadata gathered from a single scan file
+  struct ScanInfo {
+    std::string path;
+    uint64_t size = 0;
+    std::string sha256;
+    std::string format;
+    uint32_t width = 0;
+    uint32_t height = 0;
+    uint16_t bitdepth = 0;
+    uint16_t channels = 0;
+    std::string error;	///< Non-empty if the file could not be read
+  };
+
+  /// Field labels matching the values from scanValues()
+  extern const std::vector<const char*> scanLabels;
+
+  /// Format a scan as values in the order of scanLabels
+  std::vector<std::string> scanValues(const ScanInfo& info);
+
+  /// Whether a path has a TIFF or JPEG extension
+  bool isScanFile(const std::string& path);
+
+  /// Recursively list TIFF and JPEG files below a directory, sorted
+  std::vector<std::string> listScanFiles(const std::string& dir);
+
+  /// Checksum and parse the header of one file
+  ScanInfo scanFile(const std::string& path);
+
+  /// Run scanFile() over all paths on up to nthreads threads
+  ///
+  /// A thread count of 0 uses one thread per core. Results are in
+  /// the same order as paths.
+  std::vector<ScanInfo> scanFiles(const std::vector<std::string>& paths,
+				  unsigned nthreads = 0);
+}
+
+#endif // #ifndef SCAN_H
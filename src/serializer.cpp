@@ -0,0 +1,334 @@
+//===-- serializer.cpp - Record Serializer Source ---------------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the implementation of the record output
+/// formats.
+///
+//===------------------------------------------------------------===//
+
+#include "serializer.h"
+
+#include <cstring>
+#include <cstdlib>
+#include <assert.h>
+
+/// Append a quoted, escaped JSON string
+static void appendJsonString(std::string& out, const char* s)
+{
+  static const char hex[] = "0123456789abcdef";
+
+  out.push_back('"');
+
+  for (; *s; ++s) {
+    unsigned char c = *s;
+
+    switch (c) {
+    case '"':
+      out.append("\\\"", 2);
+      break;
+
+    case '\\':
+      out.append("\\\\", 2);
+      break;
+
+    case '\n':
+      out.append("\\n", 2);
+      break;
+
+    case '\t':
+      out.append("\\t", 2);
+      break;
+
+    default:
+      if (c < 0x20) {
+	char esc[] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 0xf] };
+	out.append(esc, sizeof(esc));
+      }
+      else {
+	out.push_back(c);
+      }
+
+      break;
+    }
+  }
+
+  out.push_back('"');
+}
+
+/// Append a CSV field, quoting it only when required
+static void appendCsvField(std::string& out, const char* s)
+{
+  if (std::strpbrk(s, ",\"\r\n") == NULL) {
+    out.append(s);
+    return;
+  }
+
+  out.push_back('"');
+
+  for (; *s; ++s) {
+    if (*s == '"')
+      out.push_back('"');
+
+    out.push_back(*s);
+  }
+
+  out.push_back('"');
+}
+
+/// Read a JSON string starting at the quote at pos, leaving pos after
+/// the closing quote
+static bool readJsonString(const std::string& in, size_t& pos,
+			   std::string& out)
+{
+  if (pos >= in.size() || in[pos] != '"')
+    return false;
+
+  out.clear();
+
+  for (++pos; pos < in.size(); ++pos) {
+    char c = in[pos];
+
+    if (c == '"') {
+      ++pos;
+      return true;
+    }
+
+    if (c != '\\') {
+      out.push_back(c);
+      continue;
+    }
+
+    if (++pos >= in.size())
+      return false;
+
+    switch (in[pos]) {
+    case 'n':
+      out.push_back('\n');
+      break;
+
+    case 't':
+      out.push_back('\t');
+      break;
+
+    case 'r':
+      out.push_back('\r');
+      break;
+
+    case 'b':
+      out.push_back('\b');
+      break;
+
+    case 'f':
+      out.push_back('\f');
+      break;
+
+    case 'u': {
+      // Only control characters are written escaped; anything else
+      // is left encoded as UTF-8
+      if (pos + 4 >= in.size())
+	return false;
+
+      unsigned long cp = std::strtoul(in.substr(pos + 1, 4).c_str(),
+				      NULL, 16);
+
+      if (cp < 0x80) {
+	out.push_back((char) cp);
+      }
+      else if (cp < 0x800) {
+	out.push_back((char) (0xc0 | (cp >> 6)));
+	out.push_back((char) (0x80 | (cp & 0x3f)));
+      }
+      else {
+	out.push_back((char) (0xe0 | (cp >> 12)));
+	out.push_back((char) (0x80 | ((cp >> 6) & 0x3f)));
+	out.push_back((char) (0x80 | (cp & 0x3f)));
+      }
+
+      pos += 4;
+      break;
+    }
+
+    default:
+      out.push_back(in[pos]);
+      break;
+    }
+  }
+
+  return false;
+}
+
+template<typename T>
+static void appendLittleEndian(std::string& out, T val)
+{
+  for (size_t i = 0; i < sizeof(T); ++i)
+    out.push_back((char) ((val >> (8 * i)) & 0xff));
+}
+
+void film::JsonSerializer::write(std::string& out,
+				 const std::vector<const char*>& keys,
+				 const std::vector<const char*>& values)
+{
+  assert(keys.size() == values.size());
+
+  out.append("{\n", 2);
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    out.push_back('\t');
+    appendJsonString(out, keys[i]);
+    out.append(": ", 2);
+    appendJsonString(out, values[i]);
+
+    if (i < keys.size() - 1)
+      out.push_back(',');
+
+    out.push_back('\n');
+  }
+
+  out.append("}\n", 2);
+}
+
+void film::NdjsonSerializer::write(std::string& out,
+				   const std::vector<const char*>& keys,
+				   const std::vector<const char*>& values)
+{
+  assert(keys.size() == values.size());
+
+  out.push_back('{');
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    if (i > 0)
+      out.push_back(',');
+
+    appendJsonString(out, keys[i]);
+    out.push_back(':');
+    appendJsonString(out, values[i]);
+  }
+
+  out.append("}\n", 2);
+}
+
+bool film::parseNdjson(const std::string& line,
+		       std::vector<std::string>& keys,
+		       std::vector<std::string>& values)
+{
+  size_t pos = 0;
+
+  keys.clear();
+  values.clear();
+
+  if (line.empty() || line[pos++] != '{')
+    return false;
+
+  if (pos < line.size() && line[pos] == '}')
+    return pos + 1 == line.size();
+
+  for (;;) {
+    keys.emplace_back();
+    values.emplace_back();
+
+    if (!readJsonString(line, pos, keys.back())
+	|| pos >= line.size() || line[pos++] != ':'
+	|| !readJsonString(line, pos, values.back())
+	|| pos >= line.size())
+      return false;
+
+    if (line[pos] == '}')
+      return pos + 1 == line.size();
+
+    if (line[pos++] != ',')
+      return false;
+  }
+}
+
+void film::CsvSerializer::write(std::string& out,
+				const std::vector<const char*>& keys,
+				const std::vector<const char*>& values)
+{
+  assert(keys.size() == values.size());
+
+  if (!_header) {
+    for (size_t i = 0; i < keys.size(); ++i) {
+      if (i > 0)
+	out.push_back(',');
+
+      appendCsvField(out, keys[i]);
+    }
+
+    out.append("\r\n", 2);
+    _header = true;
+  }
+
+  for (size_t i = 0; i < values.size(); ++i) {
+    if (i > 0)
+      out.push_back(',');
+
+    appendCsvField(out, values[i]);
+  }
+
+  out.append("\r\n", 2);
+}
+
+void film::BinarySerializer::write(std::string& out,
+				   const std::vector<const char*>& keys,
+				   const std::vector<const char*>& values)
+{
+  assert(keys.size() == values.size());
+
+  size_t start = out.size();
+
+  // Reserve the length prefix and fill it in once the body is known
+  appendLittleEndian<uint32_t>(out, 0);
+  appendLittleEndian<uint16_t>(out, keys.size());
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    size_t klen = std::strlen(keys[i]);
+    size_t vlen = std::strlen(values[i]);
+
+    appendLittleEndian<uint16_t>(out, klen);
+    out.append(keys[i], klen);
+    appendLittleEndian<uint32_t>(out, vlen);
+    out.append(values[i], vlen);
+  }
+
+  uint32_t len = out.size() - start - sizeof(uint32_t);
+
+  for (size_t i = 0; i < sizeof(len); ++i)
+    out[start + i] = (char) ((len >> (8 * i)) & 0xff);
+}
+
+const char* const film::serializerNames[] = {
+  "json",
+  "ndjson",
+  "csv",
+  "binary",
+  NULL
+};
+
+std::unique_ptr<film::Serializer> film::makeSerializer(const char* name,
+						      bool appending)
+{
+  assert(name);
+
+  if (std::strcmp(name, "json") == 0)
+    return std::unique_ptr<Serializer>(new JsonSerializer);
+
+  if (std::strcmp(name, "ndjson") == 0)
+    return std::unique_ptr<Serializer>(new NdjsonSerializer);
+
+  if (std::strcmp(name, "csv") == 0)
+    return std::unique_ptr<Serializer>(new CsvSerializer(appending));
+
+  if (std::strcmp(name, "binary") == 0)
+    return std::unique_ptr<Serializer>(new BinarySerializer);
+
+  return nullptr;
+}
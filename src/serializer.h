@@ -0,0 +1,94 @@
+//===-- serializer.h - Record Serializer Header -------* C++ *----===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the definitions for the formats a backend can
+/// write records in.
+///
+//===------------------------------------------------------------===//
+
+#ifndef SERIALIZER_H
+#define SERIALIZER_H
+
+#include <vector>
+#include <string>
+#include <memory>
+
+namespace film {
+  /// Abstract class to describe record output formats
+  ///
+  /// Implementations append to a caller-owned buffer so the buffer's
+  /// capacity can be reused from one record to the next.
+  class Serializer {
+  public:
+    virtual void write(std::string& out,
+		       const std::vector<const char*>& keys,
+		       const std::vector<const char*>& values) = 0;
+    virtual ~Serializer() {};
+  };
+
+  /// Pretty-printed JSON object per record
+  class JsonSerializer :public Serializer {
+  public:
+    virtual void write(std::string& out,
+		       const std::vector<const char*>& keys,
+		       const std::vector<const char*>& values) override;
+  };
+
+  /// One JSON object per line
+  class NdjsonSerializer :public Serializer {
+  public:
+    virtual void write(std::string& out,
+		       const std::vector<const char*>& keys,
+		       const std::vector<const char*>& values) override;
+  };
+
+  /// RFC 4180 CSV with a header row before the first record
+  class CsvSerializer :public Serializer {
+  public:
+    /// Leave out the header row when appending to earlier records
+    CsvSerializer(bool appending = false) :_header(appending) {}
+
+    virtual void write(std::string& out,
+		       const std::vector<const char*>& keys,
+		       const std::vector<const char*>& values) override;
+
+  private:
+    bool _header;
+  };
+
+  /// Length-prefixed little-endian binary records
+  ///
+  /// Each record is a u32 byte count of the rest of the record and a
+  /// u16 field count, followed by each field as a u16 key length,
+  /// the key, a u32 value length and the value.
+  class BinarySerializer :public Serializer {
+  public:
+    virtual void write(std::string& out,
+		       const std::vector<const char*>& keys,
+		       const std::vector<const char*>& values) override;
+  };
+
+  /// Read back a line written by NdjsonSerializer, returning false if
+  /// it isn't a flat object of strings
+  bool parseNdjson(const std::string& line, std::vector<std::string>& keys,
+		   std::vector<std::string>& values);
+
+  /// Names accepted by makeSerializer(), NULL terminated
+  extern const char* const serializerNames[];
+
+  /// Create a serializer by name, or nullptr if there is none, for
+  /// output that already holds records when appending
+  std::unique_ptr<Serializer> makeSerializer(const char* name,
+					     bool appending = false);
+}
+
+#endif // #ifndef SERIALIZER_H
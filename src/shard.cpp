@@ -0,0 +1,370 @@
+//===-- shard.cpp - Time-Partitioned Backend Source -------------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the implementation of the backend storing
+/// records in a directory of shards, one per year.
+///
+//===------------------------------------------------------------===//
+
+#include "shard.h"
+#include "stats.h"
+
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cstdarg>
+#include <cctype>
+#include <cerrno>
+#include <assert.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+
+// Shards held open for writing at once
+#define FM_SHARD_WRITERS	4
+
+const char* const film::shardField = "Date/time";
+
+static const char shardSuffix[] = ".ndjson";
+
+std::string film::shardName(const char* datetime)
+{
+  assert(datetime);
+
+  // The first run of exactly four digits is taken as the year
+  for (const char* c = datetime; *c; ++c) {
+    size_t n = 0;
+
+    while (std::isdigit((unsigned char) c[n]))
+      n++;
+
+    if (n == 4)
+      return std::string(c, 4);
+
+    if (n > 0)
+      c += n - 1;
+  }
+
+  return "undated";
+}
+
+/// Split "from..to" into its ends, either of which may be empty
+static void splitRange(const std::string& query, std::string& from,
+		       std::string& to)
+{
+  size_t dots = query.find("..");
+
+  if (query == "*") {
+    from.clear();
+    to.clear();
+  }
+  else if (dots == std::string::npos) {
+    from = query;
+    to = query;
+  }
+  else {
+    from = query.substr(0, dots);
+    to = query.substr(dots + 2);
+  }
+}
+
+/// Value to compare against a range: the date itself when it starts
+/// with the year, or else just the year
+static std::string rangeKey(const std::string& value)
+{
+  if (value.size() >= 4
+      && std::all_of(value.begin(), value.begin() + 4, ::isdigit))
+    return value;
+
+  return film::shardName(value.c_str());
+}
+
+static bool inRange(const std::string& key, const std::string& from,
+		    const std::string& to)
+{
+  return (from.empty() || key.compare(0, from.size(), from) >= 0)
+    && (to.empty() || key.compare(0, to.size(), to) <= 0);
+}
+
+/// Pull the shard field out of an NDJSON record
+static bool recordDate(const std::string& line, std::string& value)
+{
+  std::string key = std::string("\"") + film::shardField + "\":\"";
+  size_t start = line.find(key);
+
+  if (start == std::string::npos)
+    return false;
+
+  start += key.size();
+  value.clear();
+
+  for (size_t i = start; i < line.size(); ++i) {
+    if (line[i] == '"')
+      return true;
+
+    if (line[i] == '\\' && i + 1 < line.size())
+      i++;
+
+    value.push_back(line[i]);
+  }
+
+  return false;
+}
+
+film::ShardedBackend::ShardedBackend(const std::string& dir,
+				     int compresslevel)
+  :_dir(dir), _compresslevel(compresslevel)
+{
+  if (mkdir(_dir.c_str(), 0755) != 0 && errno != EEXIST) {
+    throw std::runtime_error("Failed to create shard directory " + _dir
+			     + ": " + std::strerror(errno));
+  }
+
+  flags = flags | FM_BE_RECEIVE_ENABLED;
+  init();
+}
+
+film::ShardedBackend::~ShardedBackend()
+{
+  // Each writer's backend goes before the file under it
+  _writers.clear();
+}
+
+/// Writer for a shard, closing the least recently used one to make
+/// room
+film::ShardedBackend::Writer&
+film::ShardedBackend::writer(const std::string& name)
+{
+  auto found = _writers.find(name);
+
+  if (found == _writers.end()) {
+    if (_writers.size() >= FM_SHARD_WRITERS) {
+      auto oldest = std::min_element(_writers.begin(), _writers.end(),
+				     [](const auto& a, const auto& b) {
+				       return a.second->lastuse
+					 < b.second->lastuse;
+				     });
+      _writers.erase(oldest);
+    }
+
+    std::unique_ptr<Writer> w(new Writer);
+    std::string path = _dir + "/" + name + shardSuffix;
+
+    w->file.open(path, std::ios::app | std::ios::binary);
+
+    if (w->file.fail()) {
+      throw std::runtime_error("Failed to open shard " + path);
+    }
+
+    w->backend.reset(new TextBackend(w->file, _compresslevel,
+				     std::unique_ptr<Serializer>(
+				       new NdjsonSerializer)));
+
+    found = _writers.emplace(name, std::move(w)).first;
+  }
+
+  found->second->lastuse = ++_clock;
+
+  return *found->second;
+}
+
+void film::ShardedBackend::send(std::vector<const char*>* v...)
+{
+  std::va_list args;
+
+  assert(v);
+
+  va_start(args, v);
+
+  std::vector<const char*>* varg = va_arg(args,
+					  std::vector<const char*>*);
+
+  assert(varg);
+
+  va_end(args);
+
+  const char* datetime = "";
+
+  for (size_t i = 0; i < v->size() && i < varg->size(); ++i) {
+    if (std::strcmp((*v)[i], shardField) == 0) {
+      datetime = (*varg)[i];
+      break;
+    }
+  }
+
+  writer(shardName(datetime)).backend->send(v, varg);
+}
+
+/// Shards of years overlapping [from, to], oldest first, with the
+/// undated shard last and only for unbounded queries
+std::vector<std::string>
+film::ShardedBackend::shards(const std::string& from,
+			     const std::string& to) const
+{
+  std::vector<std::string> names;
+  DIR* dir = opendir(_dir.c_str());
+
+  if (dir == NULL) {
+    throw std::runtime_error("Failed to read shard directory " + _dir);
+  }
+
+  std::string lo = from.substr(0, 4);
+  std::string hi = to.substr(0, 4);
+  size_t suffixlen = sizeof(shardSuffix) - 1;
+
+  while (struct dirent* de = readdir(dir)) {
+    std::string name = de->d_name;
+
+    if (name.size() <= suffixlen
+	|| name.compare(name.size() - suffixlen, suffixlen,
+			shardSuffix) != 0)
+      continue;
+
+    name.erase(name.size() - suffixlen);
+
+    if (name == "undated") {
+      if (from.empty() && to.empty())
+	names.push_back(name);
+
+      continue;
+    }
+
+    if (inRange(name, lo, hi))
+      names.push_back(name);
+  }
+
+  closedir(dir);
+
+  std::sort(names.begin(), names.end(), [](const auto& a, const auto& b) {
+    return b == "undated" ? a != "undated" : a != "undated" && a < b;
+  });
+
+  return names;
+}
+
+const char* film::ShardedBackend::receive(const char* query)
+{
+  if ((flags & FM_BE_RECEIVE_ENABLED) == 0) {
+    return "";
+  }
+
+  assert(query);
+
+  StatScope stat(FM_STAT_RECEIVE);
+  std::string from;
+  std::string to;
+
+  splitRange(normalize(query), from, to);
+
+  // Anything still buffered must be readable by the scan
+  flush();
+
+  std::vector<std::string> names = shards(from, to);
+  std::vector<std::vector<std::string>> found(names.size());
+  std::vector<std::string> errors(names.size());
+  std::atomic<size_t> next(0);
+  bool bounded = !from.empty() || !to.empty();
+
+  // Every shard is a separate file, so each is scanned on its own
+  // thread and only opened for the scan
+  auto work = [&]() {
+    TextBackend reader;
+    std::string value;
+
+    for (size_t i = next++; i < names.size(); i = next++) {
+      try {
+	reader.receive((_dir + "/" + names[i] + shardSuffix).c_str());
+      }
+      catch (std::exception& e) {
+	errors[i] = e.what();
+	continue;
+      }
+
+      for (const char* line : reader.results()) {
+	if (bounded && (!recordDate(line, value)
+			|| !inRange(rangeKey(value), from, to)))
+	  continue;
+
+	found[i].push_back(line);
+      }
+    }
+  };
+
+  unsigned nthreads = std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::thread> threads;
+
+  nthreads = std::min<size_t>(nthreads, names.size());
+
+  for (unsigned i = 1; i < nthreads; ++i)
+    threads.emplace_back(work);
+
+  work();
+
+  for (std::thread& t : threads)
+    t.join();
+
+  for (const std::string& e : errors) {
+    if (!e.empty())
+      throw std::runtime_error(e);
+  }
+
+  resultbuffer.clear();
+
+  for (std::vector<std::string>& shard : found) {
+    for (std::string& line : shard)
+      resultbuffer.push_back(std::move(line));
+  }
+
+  return "";
+}
+
+/// Combined stamp of the shards a query reads
+uint64_t film::ShardedBackend::version(const char* query)
+{
+  std::string from;
+  std::string to;
+  uint64_t ver = 14695981039346656037ull;
+  struct stat st;
+
+  splitRange(normalize(query), from, to);
+  flush();
+
+  for (const std::string& name : shards(from, to)) {
+    if (stat((_dir + "/" + name + shardSuffix).c_str(), &st) != 0)
+      return UINT64_MAX;
+
+    for (uint64_t v : { (uint64_t) st.st_mtim.tv_sec,
+			(uint64_t) st.st_mtim.tv_nsec,
+			(uint64_t) st.st_size }) {
+      ver = (ver ^ v) * 1099511628211ull;
+    }
+  }
+
+  return ver;
+}
+
+void film::ShardedBackend::connect()
+{
+  StatScope stat(FM_STAT_CONNECT);
+}
+
+void film::ShardedBackend::init() {};
+
+void film::ShardedBackend::flush()
+{
+  for (auto& w : _writers) {
+    w.second->backend->flush();
+    w.second->file.flush();
+  }
+}
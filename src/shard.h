@@ -0,0 +1,73 @@
+//===-- shard.h - Time-Partitioned Backend Header -----* C++ *----===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the definition of the backend storing records
+/// in a directory of shards, one per year.
+///
+//===------------------------------------------------------------===//
+
+#ifndef SHARD_H
+#define SHARD_H
+
+#include "backend.h"
+
+#include <map>
+#include <fstream>
+
+namespace film {
+  /// Field deciding the shard a record belongs in
+  extern const char* const shardField;
+
+  /// Shard holding records with the given Date/time value: its year,
+  /// or "undated" if it has none
+  std::string shardName(const char* datetime);
+
+  /// Backend keeping records in one NDJSON file per year
+  ///
+  /// Records are appended to dir/YYYY.ndjson by the year of their
+  /// Date/time field. receive() takes a range "from..to" of ISO date
+  /// prefixes such as "1965", "1965-03..1970" or "..1970", and an
+  /// empty query or "*" for everything. Only the shards of years in
+  /// range are opened, in parallel, and results come back oldest
+  /// shard first. A few shards are kept open for writing; the rest
+  /// stay closed until a record or query touches them.
+  class ShardedBackend :public Backend {
+  public:
+    ShardedBackend(const std::string& dir, int compresslevel = 0);
+    virtual ~ShardedBackend();
+
+    virtual void send(std::vector<const char*>* v...) override;
+    virtual const char* receive(const char* query) override;
+    virtual void connect() override;
+    virtual void init() override;
+    virtual void flush() override;
+    virtual uint64_t version(const char* query) override;
+
+  private:
+    struct Writer {
+      std::ofstream file;
+      std::unique_ptr<TextBackend> backend;
+      uint64_t lastuse = 0;
+    };
+
+    Writer& writer(const std::string& name);
+    std::vector<std::string> shards(const std::string& from,
+				    const std::string& to) const;
+
+    std::string _dir;
+    int _compresslevel;
+    std::map<std::string, std::unique_ptr<Writer>> _writers;
+    uint64_t _clock = 0;
+  };
+}
+
+#endif // #ifndef SHARD_H
@@ -0,0 +1,999 @@
+//===-- shm.cpp - Shared Memory Transport Source ----------------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the implementation of the shared memory ring
+/// and the backend that writes to it.
+///
+//===------------------------------------------------------------===//
+
+#include "shm.h"
+#include "stats.h"
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <new>
+#include <cstring>
+#include <cstdarg>
+#include <cerrno>
+#include <stdexcept>
+#include <assert.h>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define FM_SHM_RELAX() _mm_pause()
+#else
+#define FM_SHM_RELAX() do {} while (0)
+#endif
+
+#define FM_SHM_MAGIC		0x464d5348
+#define FM_SHM_VERSION		4
+#define FM_SHM_WRAP		0xffffffffu
+#define FM_SHM_SPINS		1000
+
+// Time a segment found half made gets to be finished before it is
+// taken for the leftovers of a server that died making it
+#define FM_SHM_CLAIMMS		1000
+
+// Field names of a request record
+#define FM_SHM_RECEIVE		"@receive"
+#define FM_SHM_REPLY		"@reply"
+
+/// Layout at the start of the segment; the ring follows it
+struct film::ShmHeader {
+  std::atomic<uint32_t> magic;
+  uint32_t version;
+  uint64_t capacity;
+
+  alignas(64) std::atomic<uint64_t> head;
+  std::atomic<uint32_t> headseq;
+  std::atomic<uint32_t> headwaiters;
+
+  alignas(64) std::atomic<uint64_t> tail;
+  std::atomic<uint32_t> tailseq;
+  std::atomic<uint32_t> tailwaiters;
+
+  // Robust, so a producer dying with it held can't wedge the rest
+  alignas(64) pthread_mutex_t wlock;
+  std::atomic<uint32_t> serving;
+  std::atomic<int32_t> server;
+
+  // Changed by the server whenever its data may have, so clients
+  // check cached results without asking it
+  alignas(64) std::atomic<uint64_t> stamp;
+
+  // Held by the server for as long as it serves, so a new server can
+  // tell a running one from one that died
+  alignas(64) pthread_mutex_t owner;
+};
+
+static const size_t headerSize = (sizeof(film::ShmHeader) + 63) & ~63ul;
+
+/// Start of a reply segment, which the answer follows
+struct ShmReply {
+  std::atomic<uint32_t> done;
+  std::atomic<uint32_t> waiters;
+  uint32_t status;
+  uint32_t size;
+};
+
+static std::string segmentName(const std::string& name)
+{
+  return name[0] == '/' ? name : "/" + name;
+}
+
+/// Wait until ready() holds, spinning before sleeping on seq
+template<typename F>
+static bool waitFor(F ready, std::atomic<uint32_t>& seq,
+		    std::atomic<uint32_t>& waiters, int timeoutms)
+{
+  for (int i = 0; i < FM_SHM_SPINS; ++i) {
+    if (ready())
+      return true;
+
+    FM_SHM_RELAX();
+  }
+
+  auto deadline = std::chrono::steady_clock::now()
+    + std::chrono::milliseconds(timeoutms);
+
+  for (;;) {
+    uint32_t expect = seq.load();
+
+    // Announce the sleep before the final check so the other side
+    // can't miss us
+    waiters.fetch_add(1);
+
+    if (ready()) {
+      waiters.fetch_sub(1);
+      return true;
+    }
+
+    auto left = deadline - std::chrono::steady_clock::now();
+
+    if (left <= std::chrono::nanoseconds(0)) {
+      waiters.fetch_sub(1);
+      return false;
+    }
+
+    auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(left)
+      .count();
+    struct timespec ts = { (time_t) (ns / 1000000000),
+			   (long) (ns % 1000000000) };
+
+    syscall(SYS_futex, (uint32_t*) &seq, FUTEX_WAIT, expect, &ts,
+	    NULL, 0);
+    waiters.fetch_sub(1);
+  }
+}
+
+static void wake(std::atomic<uint32_t>& seq, std::atomic<uint32_t>& waiters)
+{
+  seq.fetch_add(1);
+
+  if (waiters.load() > 0)
+    syscall(SYS_futex, (uint32_t*) &seq, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/// Take the producers' lock, recovering it from one that died
+/// holding it
+static void lockWriters(pthread_mutex_t* mtx, int timeoutms)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  ts.tv_sec += timeoutms / 1000;
+  ts.tv_nsec += (timeoutms % 1000) * 1000000l;
+
+  if (ts.tv_nsec >= 1000000000) {
+    ts.tv_sec++;
+    ts.tv_nsec -= 1000000000;
+  }
+
+  int err = pthread_mutex_timedlock(mtx, &ts);
+
+  // The head only moves past complete records, so anything the dead
+  // producer left half written is beyond it and gets overwritten
+  if (err == EOWNERDEAD)
+    err = pthread_mutex_consistent(mtx);
+
+  if (err == ETIMEDOUT) {
+    throw std::runtime_error("Timed out waiting for other shared memory "
+			     "clients");
+  }
+
+  if (err != 0) {
+    throw std::runtime_error(std::string("Failed to lock shared memory: ")
+			     + std::strerror(err));
+  }
+}
+
+film::ShmRing::ShmRing(const std::string& name, void* map,
+		       size_t mapsize, bool owner)
+  :_name(name), _map(map), _mapsize(mapsize), _owner(owner),
+   _hdr((ShmHeader*) map), _capacity(_hdr->capacity)
+{}
+
+static void initMutex(pthread_mutex_t* mtx)
+{
+  pthread_mutexattr_t attr;
+
+  pthread_mutexattr_init(&attr);
+  pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+  pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+  pthread_mutex_init(mtx, &attr);
+  pthread_mutexattr_destroy(&attr);
+}
+
+/// Whether fd is still the segment linked under shmname
+static bool isLinked(int fd, const std::string& shmname)
+{
+  struct stat st;
+  struct stat linked;
+  int lfd = shm_open(shmname.c_str(), O_RDONLY, 0);
+  bool same = lfd >= 0 && fstat(fd, &st) == 0 && fstat(lfd, &linked) == 0
+    && st.st_dev == linked.st_dev && st.st_ino == linked.st_ino;
+
+  if (lfd >= 0)
+    close(lfd);
+
+  return same;
+}
+
+/// Take over the segment fd, mapped at map, from a server that died,
+/// returning false if it was replaced or removed meanwhile
+///
+/// Only a server holding the owner lock is running, so the lock is
+/// what tells; the pid could have been reused. A segment that never
+/// gets its magic was left by a server that died making it.
+static bool claim(int fd, const std::string& shmname, void* map)
+{
+  film::ShmHeader* hdr = (film::ShmHeader*) map;
+  auto deadline = std::chrono::steady_clock::now()
+    + std::chrono::milliseconds(FM_SHM_CLAIMMS);
+  struct stat st;
+
+  for (;;) {
+    if (fstat(fd, &st) != 0) {
+      throw std::runtime_error("Failed to read shared memory " + shmname
+			       + ": " + std::strerror(errno));
+    }
+
+    if ((size_t) st.st_size >= headerSize
+	&& hdr->magic.load(std::memory_order_acquire) == FM_SHM_MAGIC)
+      break;
+
+    if (std::chrono::steady_clock::now() >= deadline) {
+      if (isLinked(fd, shmname))
+	shm_unlink(shmname.c_str());
+
+      return false;
+    }
+
+    usleep(10000);
+  }
+
+  if (hdr->version != FM_SHM_VERSION) {
+    throw std::runtime_error("Shared memory " + shmname + " is in use by "
+			     "another version; remove it if no server is "
+			     "running");
+  }
+
+  int err = pthread_mutex_trylock(&hdr->owner);
+
+  if (err == EOWNERDEAD)
+    err = pthread_mutex_consistent(&hdr->owner);
+
+  if (err == EBUSY) {
+    throw std::runtime_error("A server is already serving " + shmname);
+  }
+
+  if (err != 0) {
+    throw std::runtime_error("Failed to lock shared memory " + shmname
+			     + ": " + std::strerror(err));
+  }
+
+  // A server that stopped unlocks after unlinking, so the lock can
+  // come free on a segment that is gone
+  if (!isLinked(fd, shmname)) {
+    pthread_mutex_unlock(&hdr->owner);
+    return false;
+  }
+
+  return true;
+}
+
+film::ShmRing* film::ShmRing::create(const std::string& name,
+				     size_t capacity)
+{
+  std::string shmname = segmentName(name);
+  size_t cap = 4096;
+
+  while (cap < capacity)
+    cap = cap * 2;
+
+  size_t mapsize = headerSize + cap;
+
+  for (;;) {
+    int fd = shm_open(shmname.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+    bool fresh = fd >= 0;
+
+    if (!fresh && errno == EEXIST) {
+      fd = shm_open(shmname.c_str(), O_RDWR, 0);
+
+      if (fd < 0 && errno == ENOENT)
+	continue;
+    }
+
+    if (fd < 0) {
+      throw std::runtime_error("Failed to create shared memory "
+			       + shmname + ": " + std::strerror(errno));
+    }
+
+    // Mapped at its final size from the start, since the owner lock
+    // must stay at one address while it is held
+    void* map = mmap(NULL, mapsize, PROT_READ | PROT_WRITE, MAP_SHARED,
+		     fd, 0);
+
+    if (map == MAP_FAILED) {
+      close(fd);
+
+      if (fresh)
+	shm_unlink(shmname.c_str());
+
+      throw std::runtime_error("Failed to map shared memory " + shmname);
+    }
+
+    ShmHeader* hdr = (ShmHeader*) map;
+
+    try {
+      if (!fresh && !claim(fd, shmname, map)) {
+	munmap(map, mapsize);
+	close(fd);
+	continue;
+      }
+    }
+    catch (...) {
+      munmap(map, mapsize);
+      close(fd);
+      throw;
+    }
+
+    // Clients check the magic last, so a reused segment loses it first
+    if (!fresh)
+      hdr->magic.store(0);
+
+    if (ftruncate(fd, mapsize) != 0) {
+      if (!fresh)
+	pthread_mutex_unlock(&hdr->owner);
+
+      munmap(map, mapsize);
+      close(fd);
+      shm_unlink(shmname.c_str());
+      throw std::runtime_error("Failed to size shared memory "
+			       + shmname);
+    }
+
+    close(fd);
+
+    if (fresh) {
+      new (map) ShmHeader();
+      initMutex(&hdr->owner);
+      pthread_mutex_lock(&hdr->owner);
+    }
+    else {
+      hdr->head.store(0);
+      hdr->tail.store(0);
+    }
+
+    initMutex(&hdr->wlock);
+
+    hdr->version = FM_SHM_VERSION;
+    hdr->capacity = cap;
+    hdr->server.store(getpid());
+    hdr->serving.store(1);
+
+    // Never equal to a stamp of an earlier server under the name, so
+    // results cached from that one are never taken for current
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    hdr->stamp.store((uint64_t) now.tv_sec * 1000000000 + now.tv_nsec);
+
+    // Clients check the magic last, so it goes in last
+    hdr->magic.store(FM_SHM_MAGIC, std::memory_order_release);
+
+    return new ShmRing(shmname, map, mapsize, true);
+  }
+}
+
+film::ShmRing* film::ShmRing::open(const std::string& name)
+{
+  std::string shmname = segmentName(name);
+  struct stat st;
+
+  int fd = shm_open(shmname.c_str(), O_RDWR, 0);
+
+  if (fd < 0) {
+    throw std::runtime_error("No shared memory server at " + shmname);
+  }
+
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < headerSize) {
+    close(fd);
+    throw std::runtime_error("Invalid shared memory segment " + shmname);
+  }
+
+  void* map = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED,
+		   fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED) {
+    throw std::runtime_error("Failed to map shared memory " + shmname);
+  }
+
+  ShmHeader* hdr = (ShmHeader*) map;
+
+  // A server that crashed never cleared serving, so it has to still
+  // be running as well
+  if (hdr->magic.load(std::memory_order_acquire) != FM_SHM_MAGIC
+      || hdr->version != FM_SHM_VERSION
+      || hdr->capacity < 4096
+      || (hdr->capacity & (hdr->capacity - 1)) != 0
+      || headerSize + hdr->capacity > (size_t) st.st_size
+      || hdr->serving.load() == 0
+      || (kill(hdr->server.load(), 0) != 0 && errno == ESRCH)) {
+    munmap(map, st.st_size);
+    throw std::runtime_error("No shared memory server at " + shmname);
+  }
+
+  return new ShmRing(shmname, map, st.st_size, false);
+}
+
+film::ShmRing::~ShmRing()
+{
+  // The owner lock goes last, once no new server can find the
+  // segment, and before unmapping, as glibc keeps held robust locks
+  // on a list running through them
+  if (_owner) {
+    _hdr->serving.store(0);
+    wake(_hdr->tailseq, _hdr->tailwaiters);
+    shm_unlink(_name.c_str());
+    pthread_mutex_unlock(&_hdr->owner);
+  }
+
+  munmap(_map, _mapsize);
+}
+
+uint64_t film::ShmRing::stamp() const
+{
+  return _hdr->stamp.load(std::memory_order_acquire);
+}
+
+void film::ShmRing::touch()
+{
+  _hdr->stamp.fetch_add(1, std::memory_order_release);
+}
+
+char* film::ShmRing::data(uint64_t pos)
+{
+  return (char*) _map + headerSize + (pos & (_capacity - 1));
+}
+
+uint64_t film::ShmRing::publish(const std::vector<const char*>& keys,
+				const std::vector<const char*>& values,
+				int timeoutms)
+{
+  assert(keys.size() == values.size());
+
+  uint64_t cap = _capacity;
+  size_t need = 2 * sizeof(uint32_t);
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    need += 2 * sizeof(uint32_t) + std::strlen(keys[i])
+      + std::strlen(values[i]) + 2;
+  }
+
+  uint32_t reclen = (need + 7) & ~7ul;
+
+  if (reclen > cap / 2)
+    throw std::runtime_error("Record too large for shared memory ring");
+
+  // Room for the record at the head, skipping to the start of the
+  // ring if it would straddle the end
+  auto skipAt = [&](uint64_t head) -> uint64_t {
+    uint64_t room = cap - (head & (cap - 1));
+
+    return room < reclen ? room : 0;
+  };
+
+  auto fits = [&] {
+    uint64_t head = _hdr->head.load(std::memory_order_acquire);
+
+    return head + skipAt(head) + reclen
+      - _hdr->tail.load(std::memory_order_acquire) <= cap;
+  };
+
+  auto deadline = std::chrono::steady_clock::now()
+    + std::chrono::milliseconds(timeoutms);
+  uint64_t head;
+  uint64_t skip;
+
+  for (;;) {
+    auto left = std::chrono::duration_cast<std::chrono::milliseconds>
+      (deadline - std::chrono::steady_clock::now()).count();
+
+    // Space is waited for without the lock, so a full ring never
+    // holds up the other producers
+    if (left <= 0 || !waitFor(fits, _hdr->tailseq, _hdr->tailwaiters,
+			      left)) {
+      throw std::runtime_error("Shared memory server stopped consuming");
+    }
+
+    lockWriters(&_hdr->wlock, left);
+
+    head = _hdr->head.load(std::memory_order_relaxed);
+    skip = skipAt(head);
+
+    if (fits())
+      break;
+
+    pthread_mutex_unlock(&_hdr->wlock);
+  }
+
+  if (skip) {
+    uint32_t wrap = FM_SHM_WRAP;
+    std::memcpy(data(head), &wrap, sizeof(wrap));
+    head += skip;
+  }
+
+  char* p = data(head);
+  uint32_t nfields = keys.size();
+
+  std::memcpy(p, &reclen, sizeof(reclen));
+  std::memcpy(p + 4, &nfields, sizeof(nfields));
+  p += 8;
+
+  for (size_t i = 0; i < keys.size(); ++i) {
+    for (const char* s : { keys[i], values[i] }) {
+      uint32_t len = std::strlen(s);
+
+      std::memcpy(p, &len, sizeof(len));
+      std::memcpy(p + 4, s, len + 1);
+      p += 4 + len + 1;
+    }
+  }
+
+  head += reclen;
+  _hdr->head.store(head, std::memory_order_release);
+  pthread_mutex_unlock(&_hdr->wlock);
+
+  wake(_hdr->headseq, _hdr->headwaiters);
+
+  return head;
+}
+
+bool film::ShmRing::waitConsumed(uint64_t pos, int timeoutms)
+{
+  auto done = [&] {
+    return _hdr->tail.load(std::memory_order_acquire) >= pos
+      || _hdr->serving.load(std::memory_order_relaxed) == 0;
+  };
+
+  waitFor(done, _hdr->tailseq, _hdr->tailwaiters, timeoutms);
+
+  return _hdr->tail.load(std::memory_order_acquire) >= pos;
+}
+
+size_t film::ShmRing::consume(const consumer& fn, int timeoutms)
+{
+  uint64_t cap = _capacity;
+  uint64_t tail = _hdr->tail.load(std::memory_order_relaxed);
+  size_t n = 0;
+
+  if (!waitFor([&] {
+	return _hdr->head.load(std::memory_order_acquire) != tail;
+      }, _hdr->headseq, _hdr->headwaiters, timeoutms))
+    return 0;
+
+  uint64_t head = _hdr->head.load(std::memory_order_acquire);
+
+  // Any client can write anything into the segment, so every length
+  // is checked before it is used. A bad record length loses track of
+  // the records after it, and everything written so far is dropped.
+  auto dropAll = [&] {
+    _dropped++;
+    tail = head;
+    _hdr->tail.store(tail, std::memory_order_release);
+    wake(_hdr->tailseq, _hdr->tailwaiters);
+  };
+
+  if (head - tail > cap) {
+    dropAll();
+    return n;
+  }
+
+  while (tail != head) {
+    const char* p = data(tail);
+    uint64_t avail = std::min(head - tail, cap - (tail & (cap - 1)));
+    uint32_t reclen;
+    uint32_t nfields;
+
+    std::memcpy(&reclen, p, sizeof(reclen));
+
+    if (reclen == FM_SHM_WRAP && head - tail >= avail) {
+      tail += avail;
+      continue;
+    }
+
+    if (reclen < 8 || reclen > avail || reclen % 8 != 0) {
+      dropAll();
+      break;
+    }
+
+    const char* end = p + reclen;
+
+    std::memcpy(&nfields, p + 4, sizeof(nfields));
+    p += 8;
+
+    // Strings are NUL-terminated in the ring, so they are used where
+    // they lie
+    _keys.clear();
+    _values.clear();
+
+    for (uint32_t i = 0; i < nfields && p; ++i) {
+      for (std::vector<const char*>* v : { &_keys, &_values }) {
+	uint32_t len;
+
+	if (end - p < 5) {
+	  p = nullptr;
+	  break;
+	}
+
+	std::memcpy(&len, p, sizeof(len));
+
+	if (len > (size_t) (end - p) - 5 || p[4 + len] != '\0') {
+	  p = nullptr;
+	  break;
+	}
+
+	v->push_back(p + 4);
+	p += 4 + len + 1;
+      }
+    }
+
+    // A malformed record is dropped on its own
+    if (!p) {
+      _dropped++;
+      tail += reclen;
+      _hdr->tail.store(tail, std::memory_order_release);
+      wake(_hdr->tailseq, _hdr->tailwaiters);
+      continue;
+    }
+
+    try {
+      fn(_keys, _values);
+    }
+    catch (...) {
+      _hdr->tail.store(tail + reclen, std::memory_order_release);
+      wake(_hdr->tailseq, _hdr->tailwaiters);
+      throw;
+    }
+
+    tail += reclen;
+    n++;
+
+    _hdr->tail.store(tail, std::memory_order_release);
+    wake(_hdr->tailseq, _hdr->tailwaiters);
+
+    if (tail == head) {
+      head = _hdr->head.load(std::memory_order_acquire);
+
+      if (head - tail > cap) {
+	dropAll();
+	break;
+      }
+    }
+  }
+
+  return n;
+}
+
+static void appendString(std::string& out, const char* s, size_t len)
+{
+  uint32_t n = len;
+
+  out.append((const char*) &n, sizeof(n));
+  out.append(s, len);
+}
+
+/// Read a string written by appendString() at off, moving past it
+static bool readString(const std::string& in, size_t& off,
+		       std::string& s)
+{
+  uint32_t n;
+
+  if (in.size() - off < sizeof(n))
+    return false;
+
+  std::memcpy(&n, in.data() + off, sizeof(n));
+  off += sizeof(n);
+
+  if (in.size() - off < n)
+    return false;
+
+  s.assign(in, off, n);
+  off += n;
+
+  return true;
+}
+
+film::ShmServer::ShmServer(const std::string& name, Backend& be)
+  :_ring(ShmRing::create(name)), _be(be)
+{
+  if ((_be.flags & FM_BE_CONCURRENT_READS) != 0)
+    _queries = std::thread(&ShmServer::runQueries, this);
+}
+
+film::ShmServer::~ShmServer()
+{
+  {
+    std::lock_guard<std::mutex> lock(_querymtx);
+    _stop = true;
+  }
+
+  _querycv.notify_one();
+
+  if (_queries.joinable())
+    _queries.join();
+}
+
+size_t film::ShmServer::serve(int timeoutms)
+{
+  bool saved;
+  auto handle = [this, &saved](std::vector<const char*>& keys,
+			       std::vector<const char*>& values) {
+    if (keys.size() == 2 && std::strcmp(keys[0], FM_SHM_RECEIVE) == 0
+	&& std::strcmp(keys[1], FM_SHM_REPLY) == 0) {
+      if (!_queries.joinable()) {
+	answer(values[0], values[1]);
+	return;
+      }
+
+      {
+	std::lock_guard<std::mutex> lock(_querymtx);
+	_pending.push_back({ values[0], values[1] });
+      }
+
+      _querycv.notify_one();
+      return;
+    }
+
+    // Stamped before the record is acknowledged, so the client that
+    // sent it never finds its own write missing from a cached result
+    _be.send(&keys, &values);
+    _ring->touch();
+    saved = true;
+  };
+
+  saved = false;
+
+  size_t n = _ring->consume(handle, timeoutms);
+
+  // Stamped again once flushed, as results read from a backend that
+  // buffers can have been cached under the earlier stamp
+  if (saved) {
+    _be.flush();
+    _ring->touch();
+  }
+
+  return n;
+}
+
+/// Answer queries in turn until the server stops
+void film::ShmServer::runQueries()
+{
+  std::unique_lock<std::mutex> lock(_querymtx);
+
+  for (;;) {
+    _querycv.wait(lock, [this] { return _stop || !_pending.empty(); });
+
+    if (_stop)
+      return;
+
+    Request req = std::move(_pending.front());
+    _pending.pop_front();
+
+    lock.unlock();
+    answer(req.query.c_str(), req.reply.c_str());
+    lock.lock();
+  }
+}
+
+/// Write the answer to a request into the reply segment and wake the
+/// client waiting on it
+void film::ShmServer::answer(const char* query, const char* reply)
+{
+  std::string prefix = _ring->name() + ".reply.";
+
+  // Only ever write to the reply segments of this ring's clients
+  if (std::strncmp(reply, prefix.c_str(), prefix.size()) != 0
+      || std::strchr(reply + 1, '/') != NULL)
+    return;
+
+  int fd = shm_open(reply, O_RDWR, 0);
+  struct stat st;
+
+  if (fd < 0)
+    return;
+
+  if (fstat(fd, &st) != 0 || (size_t) st.st_size < sizeof(ShmReply)) {
+    close(fd);
+    return;
+  }
+
+  uint32_t status = 0;
+  std::string out;
+
+  try {
+    _be.receive(query);
+
+    for (const char* r : _be.results())
+      appendString(out, r, std::strlen(r));
+  }
+  catch (std::exception& e) {
+    status = 1;
+    out.clear();
+    appendString(out, e.what(), std::strlen(e.what()));
+  }
+
+  for (size_t off = 0; off < out.size();) {
+    ssize_t n = pwrite(fd, out.data() + off, out.size() - off,
+		       sizeof(ShmReply) + off);
+
+    if (n < 0 && errno == EINTR)
+      continue;
+
+    if (n <= 0) {
+      status = 1;
+      out.clear();
+      break;
+    }
+
+    off += n;
+  }
+
+  void* map = mmap(NULL, sizeof(ShmReply), PROT_READ | PROT_WRITE,
+		   MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED)
+    return;
+
+  ShmReply* rep = (ShmReply*) map;
+
+  rep->status = status;
+  rep->size = out.size();
+  wake(rep->done, rep->waiters);
+
+  munmap(map, sizeof(ShmReply));
+}
+
+film::ShmBackend::ShmBackend(const std::string& name, int timeoutms)
+  :_ring(ShmRing::open(name)), _timeoutms(timeoutms)
+{
+  flags = flags | FM_BE_RECEIVE_ENABLED;
+  init();
+}
+
+void film::ShmBackend::send(std::vector<const char*>* v...)
+{
+  StatScope stat(FM_STAT_SEND);
+  std::va_list args;
+
+  assert(v);
+
+  va_start(args, v);
+
+  std::vector<const char*>* varg = va_arg(args,
+					  std::vector<const char*>*);
+
+  assert(varg);
+
+  va_end(args);
+
+  uint64_t pos = _ring->publish(*v, *varg, _timeoutms);
+
+  if (!_ring->waitConsumed(pos, _timeoutms))
+    throw std::runtime_error("Shared memory server did not confirm save");
+}
+
+/// Send a request to the server and return the body of its answer
+std::string film::ShmBackend::request(const char* op, const char* query)
+{
+  std::string reply = _ring->name() + ".reply." + std::to_string(getpid())
+    + "." + std::to_string(_requests++);
+  int fd = shm_open(reply.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+
+  if (fd < 0) {
+    throw std::runtime_error("Failed to create shared memory " + reply
+			     + ": " + std::strerror(errno));
+  }
+
+  void* map = MAP_FAILED;
+
+  if (ftruncate(fd, sizeof(ShmReply)) == 0) {
+    map = mmap(NULL, sizeof(ShmReply), PROT_READ | PROT_WRITE, MAP_SHARED,
+	       fd, 0);
+  }
+
+  if (map == MAP_FAILED) {
+    shm_unlink(reply.c_str());
+    close(fd);
+    throw std::runtime_error("Failed to map shared memory " + reply);
+  }
+
+  ShmReply* rep = (ShmReply*) map;
+  std::vector<const char*> keys = { op, FM_SHM_REPLY };
+  std::vector<const char*> values = { query, reply.c_str() };
+  bool answered = false;
+
+  try {
+    _ring->publish(keys, values, _timeoutms);
+    answered = waitFor([rep] { return rep->done.load() != 0; }, rep->done,
+		       rep->waiters, _timeoutms);
+  }
+  catch (...) {
+    shm_unlink(reply.c_str());
+    munmap(map, sizeof(ShmReply));
+    close(fd);
+    throw;
+  }
+
+  shm_unlink(reply.c_str());
+
+  uint32_t status = rep->status;
+  std::string out(answered ? rep->size : 0, '\0');
+  struct stat st;
+
+  munmap(map, sizeof(ShmReply));
+
+  if (answered && (fstat(fd, &st) != 0
+		   || (size_t) st.st_size < sizeof(ShmReply) + out.size()
+		   || pread(fd, &out[0], out.size(), sizeof(ShmReply))
+		   != (ssize_t) out.size()))
+    answered = false;
+
+  close(fd);
+
+  if (!answered) {
+    throw std::runtime_error("Shared memory server did not answer");
+  }
+
+  size_t off = 0;
+  std::string message;
+
+  if (status != 0) {
+    readString(out, off, message);
+    throw std::runtime_error(message);
+  }
+
+  return out;
+}
+
+const char* film::ShmBackend::receive(const char* query)
+{
+  if ((flags & FM_BE_RECEIVE_ENABLED) == 0) {
+    return "";
+  }
+
+  assert(query);
+
+  StatScope stat(FM_STAT_RECEIVE);
+  std::string body = request(FM_SHM_RECEIVE, query);
+  std::string result;
+  size_t off = 0;
+
+  resultbuffer.clear();
+
+  while (off < body.size()) {
+    if (!readString(body, off, result)) {
+      throw std::runtime_error("Malformed answer from shared memory "
+			       "server");
+    }
+
+    resultbuffer.push_back(std::move(result));
+  }
+
+  return "";
+}
+
+/// The stamp the server publishes, so checking a cached result costs
+/// no round trip
+uint64_t film::ShmBackend::version(const char* query)
+{
+  return _ring->stamp();
+}
+
+void film::ShmBackend::connect()
+{
+  StatScope stat(FM_STAT_CONNECT);
+}
+
+void film::ShmBackend::init() {};
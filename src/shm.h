@@ -0,0 +1,170 @@
+//===-- shm.h - Shared Memory Transport Header --------* C++ *----===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the definitions for passing records between a
+/// client and a server on the same host through a ring buffer in
+/// POSIX shared memory.
+///
+//===------------------------------------------------------------===//
+
+#ifndef SHM_H
+#define SHM_H
+
+#include "backend.h"
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace film {
+  struct ShmHeader;
+
+  /// Single-consumer, multi-producer record ring in shared memory
+  ///
+  /// Records are encoded once, straight into the ring, as a u32
+  /// length and u32 field count followed by each key and value as a
+  /// u32 length and NUL-terminated bytes. The consumer reads them in
+  /// place, after checking every length. Each side spins briefly
+  /// before sleeping on a futex in the segment, and only issues a
+  /// wake-up when the other side sleeps. Producers take turns under a
+  /// robust process-shared mutex.
+  class ShmRing {
+  public:
+    typedef std::function<void(std::vector<const char*>& keys,
+			       std::vector<const char*>& values)> consumer;
+
+    /// Create the segment and serve it until destroyed, taking it
+    /// over from a server that died but failing if one is running
+    static ShmRing* create(const std::string& name,
+			   size_t capacity = 1 << 22);
+
+    /// Attach to a segment a server is serving
+    static ShmRing* open(const std::string& name);
+
+    ~ShmRing();
+
+    ShmRing(const ShmRing&) = delete;
+    ShmRing& operator=(const ShmRing&) = delete;
+
+    /// Append a record, returning the position the consumer must
+    /// pass for it to have been processed
+    uint64_t publish(const std::vector<const char*>& keys,
+		     const std::vector<const char*>& values,
+		     int timeoutms);
+
+    /// Wait until the consumer has processed up to pos
+    bool waitConsumed(uint64_t pos, int timeoutms);
+
+    /// Pass waiting records to fn in place, waiting up to timeoutms
+    /// for the first, and return the number processed
+    size_t consume(const consumer& fn, int timeoutms);
+
+    /// Malformed records, or runs of them, dropped by consume()
+    size_t dropped() const { return _dropped; }
+
+    /// Name of the segment
+    const std::string& name() const { return _name; }
+
+    /// Stamp of the server's data, changing whenever it may have
+    uint64_t stamp() const;
+
+    /// Change the stamp, after the server's data may have changed
+    void touch();
+
+  private:
+    ShmRing(const std::string& name, void* map, size_t mapsize,
+	    bool owner);
+
+    char* data(uint64_t pos);
+
+    std::string _name;
+    void* _map;
+    size_t _mapsize;
+    bool _owner;
+    ShmHeader* _hdr;
+    uint64_t _capacity;
+    size_t _dropped = 0;
+    std::vector<const char*> _keys;
+    std::vector<const char*> _values;
+  };
+
+  /// Server end of a ShmRing, saving records to a backend and
+  /// answering queries from it
+  ///
+  /// A request is a record of two fields: "@receive" with the query,
+  /// then "@reply" naming a segment the client made for the answer.
+  /// The answer is an error message or each result, as a u32 length
+  /// and the bytes, after a header the client waits on. A backend
+  /// with FM_BE_CONCURRENT_READS answers on a thread of its own, so
+  /// long queries don't hold up records being saved. The ring's
+  /// stamp is changed for every record saved, so clients can tell
+  /// when cached results are stale; records saved to the backend
+  /// other than through the ring go unnoticed.
+  class ShmServer {
+  public:
+    ShmServer(const std::string& name, Backend& be);
+    ~ShmServer();
+
+    /// Handle waiting records, waiting up to timeoutms for the first,
+    /// and return the number handled
+    size_t serve(int timeoutms);
+
+    /// Malformed records dropped so far
+    size_t dropped() const { return _ring->dropped(); }
+
+  private:
+    struct Request {
+      std::string query;
+      std::string reply;
+    };
+
+    void answer(const char* query, const char* reply);
+    void runQueries();
+
+    std::unique_ptr<ShmRing> _ring;
+    Backend& _be;
+
+    std::thread _queries;
+    std::mutex _querymtx;
+    std::condition_variable _querycv;
+    std::deque<Request> _pending;
+    bool _stop = false;
+  };
+
+  /// Backend sending records to a local server through a ShmRing
+  ///
+  /// send() returns once the server has consumed the record. Queries
+  /// are answered by the server's backend, and version() is the stamp
+  /// the server publishes in the ring.
+  class ShmBackend :public Backend {
+  public:
+    virtual void send(std::vector<const char*>* v...) override;
+    virtual const char* receive(const char* query) override;
+    virtual void connect() override;
+    virtual void init() override;
+    virtual uint64_t version(const char* query) override;
+    ShmBackend(const std::string& name, int timeoutms = 2000);
+
+  private:
+    std::string request(const char* op, const char* query);
+
+    std::unique_ptr<ShmRing> _ring;
+    int _timeoutms;
+    unsigned _requests = 0;
+  };
+}
+
+#endif // #ifndef SHM_H
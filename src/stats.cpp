@@ -0,0 +1,309 @@
+//===-- stats.cpp - Hot Path Instrumentation Source -------------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the implementation of the per-thread latency
+/// histograms and their reporting.
+///
+//===------------------------------------------------------------===//
+
+#include "stats.h"
+
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+int fm_stats_flags = 0;
+
+static const char* const statNames[FM_STAT_COUNT] = {
+  "connect",
+  "send",
+  "receive",
+  "autocomplete",
+  "form build",
+  "keystroke",
+  "fetch"
+};
+
+// Histogram buckets are exact below 16ns, then each power of two is
+// split into 16 linear steps, giving about 6% resolution everywhere
+#define FM_STATS_SUBBITS	4
+#define FM_STATS_SUBCOUNT	(1 << FM_STATS_SUBBITS)
+#define FM_STATS_BUCKETS	((64 - FM_STATS_SUBBITS + 1) * FM_STATS_SUBCOUNT)
+
+static unsigned bucketOf(uint64_t ns)
+{
+  if (ns < FM_STATS_SUBCOUNT)
+    return ns;
+
+  unsigned exp = 63 - __builtin_clzll(ns);
+  unsigned sub = (ns >> (exp - FM_STATS_SUBBITS)) & (FM_STATS_SUBCOUNT - 1);
+
+  return (exp - FM_STATS_SUBBITS + 1) * FM_STATS_SUBCOUNT + sub;
+}
+
+static uint64_t bucketFloor(unsigned bucket)
+{
+  if (bucket < FM_STATS_SUBCOUNT)
+    return bucket;
+
+  unsigned exp = bucket / FM_STATS_SUBCOUNT + FM_STATS_SUBBITS - 1;
+  uint64_t sub = bucket % FM_STATS_SUBCOUNT;
+
+  return (1ull << exp) | (sub << (exp - FM_STATS_SUBBITS));
+}
+
+/// Single-writer counter, readable from the reporting thread
+///
+/// Only the owning thread updates it, so a relaxed load and store
+/// avoids the cost of an atomic read-modify-write. The builtins are
+/// used over std::atomic because they stay inline in unoptimized
+/// builds.
+class Counter {
+public:
+  void add(uint64_t n)
+  {
+    __atomic_store_n(&_val, __atomic_load_n(&_val, __ATOMIC_RELAXED) + n,
+		     __ATOMIC_RELAXED);
+  }
+
+  void max(uint64_t n)
+  {
+    if (n > __atomic_load_n(&_val, __ATOMIC_RELAXED))
+      __atomic_store_n(&_val, n, __ATOMIC_RELAXED);
+  }
+
+  uint64_t get() const
+  {
+    return __atomic_load_n(&_val, __ATOMIC_RELAXED);
+  }
+
+private:
+  uint64_t _val = 0;
+};
+
+// One section in this many is timed while only collecting stats, and
+// the rest are just counted inline. Tracing times every section.
+#define FM_STATS_SAMPLE		64
+
+// Trace events kept per thread, the oldest giving way to the newest
+#define FM_STATS_TRACE_EVENTS	(1 << 16)
+
+struct TraceEvent {
+  fm_stat_id id;
+  uint64_t start;
+  uint64_t duration;
+};
+
+struct ThreadStats {
+  unsigned tid;
+  fm_stats_thread local = {};
+  Counter started[FM_STAT_COUNT];
+  Counter timed[FM_STAT_COUNT];
+  Counter total[FM_STAT_COUNT];
+  Counter max[FM_STAT_COUNT];
+  Counter buckets[FM_STAT_COUNT][FM_STATS_BUCKETS];
+  std::unique_ptr<TraceEvent[]> trace;
+  Counter traced;
+};
+
+// Thread records are never freed so their numbers survive the thread
+static std::mutex registryMutex;
+static std::vector<ThreadStats*> registry;
+
+// Read directly rather than through a function so the lookup stays
+// inline in unoptimized builds
+static thread_local ThreadStats* localStats = nullptr;
+
+__thread fm_stats_thread* fm_stats_local = nullptr;
+
+static ThreadStats* registerThread()
+{
+  localStats = new ThreadStats;
+  fm_stats_local = &localStats->local;
+
+  std::lock_guard<std::mutex> lock(registryMutex);
+  localStats->tid = registry.size() + 1;
+  registry.push_back(localStats);
+
+  return localStats;
+}
+
+// Sections are timed in raw clock ticks and converted on the way out
+// with a factor measured when stats are enabled. On x86 the TSC is
+// read directly, which costs a fraction of a clock_gettime() call.
+static double nsPerTick = 1.0;
+
+static uint64_t clockNs()
+{
+  struct timespec tp;
+
+  clock_gettime(CLOCK_MONOTONIC, &tp);
+
+  return (uint64_t) tp.tv_sec * 1000000000ull + tp.tv_nsec;
+}
+
+static inline uint64_t nowTicks()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return clockNs();
+#endif
+}
+
+void fm_stats_enable(int flags)
+{
+#if defined(__x86_64__) || defined(__i386__)
+  uint64_t ns0 = clockNs();
+  uint64_t tick0 = nowTicks();
+  uint64_t ns1;
+
+  // Five milliseconds keeps the factor within a few parts per million
+  do {
+    ns1 = clockNs();
+  } while (ns1 - ns0 < 5000000);
+
+  nsPerTick = (double) (ns1 - ns0) / (nowTicks() - tick0);
+#endif
+
+  fm_stats_flags = flags;
+}
+
+uint64_t fm_stats_begin_slow(enum fm_stat_id id)
+{
+  ThreadStats& ts = localStats ? *localStats : *registerThread();
+
+  // This section stands for itself and the ones the inline path
+  // counts down in between, so every section is counted as started
+  // less those still to come
+  unsigned skip = (fm_stats_flags & FM_STATS_TRACE) ? 0
+    : FM_STATS_SAMPLE - 1;
+
+  ts.started[id].add(skip + 1);
+  __atomic_store_n(&ts.local.skip[id], skip, __ATOMIC_RELAXED);
+
+  return nowTicks();
+}
+
+void fm_stats_end_slow(enum fm_stat_id id, uint64_t start)
+{
+  ThreadStats& ts = localStats ? *localStats : *registerThread();
+  uint64_t ns = (nowTicks() - start) * nsPerTick;
+
+  ts.timed[id].add(1);
+  ts.total[id].add(ns);
+  ts.max[id].max(ns);
+  ts.buckets[id][bucketOf(ns)].add(1);
+
+  if (fm_stats_flags & FM_STATS_TRACE) {
+    if (!ts.trace)
+      ts.trace.reset(new TraceEvent[FM_STATS_TRACE_EVENTS]);
+
+    TraceEvent& ev = ts.trace[ts.traced.get() % FM_STATS_TRACE_EVENTS];
+
+    ev.id = id;
+    ev.start = start * nsPerTick;
+    ev.duration = ns;
+    ts.traced.add(1);
+  }
+}
+
+void fm_stats_dump(FILE* out)
+{
+  std::lock_guard<std::mutex> lock(registryMutex);
+
+  fprintf(out, "%-14s %10s %12s %12s %12s %12s %12s\n", "Section",
+	  "Count", "Mean us", "p50 us", "p90 us", "p99 us", "Max us");
+
+  for (int id = 0; id < FM_STAT_COUNT; ++id) {
+    uint64_t count = 0;
+    uint64_t timed = 0;
+    uint64_t total = 0;
+    uint64_t max = 0;
+    std::vector<uint64_t> hist(FM_STATS_BUCKETS, 0);
+
+    for (const ThreadStats* ts : registry) {
+      count += ts->started[id].get()
+	- __atomic_load_n(&ts->local.skip[id], __ATOMIC_RELAXED);
+      timed += ts->timed[id].get();
+      total += ts->total[id].get();
+      max = std::max(max, ts->max[id].get());
+
+      for (unsigned b = 0; b < FM_STATS_BUCKETS; ++b)
+	hist[b] += ts->buckets[id][b].get();
+    }
+
+    if (timed == 0)
+      continue;
+
+    const double pcts[] = { 0.50, 0.90, 0.99 };
+    double pvals[3] = { 0, 0, 0 };
+    uint64_t seen = 0;
+    unsigned p = 0;
+
+    for (unsigned b = 0; b < FM_STATS_BUCKETS && p < 3; ++b) {
+      seen += hist[b];
+
+      while (p < 3 && seen >= pcts[p] * timed)
+	pvals[p++] = bucketFloor(b) / 1e3;
+    }
+
+    fprintf(out, "%-14s %10llu %12.3f %12.3f %12.3f %12.3f %12.3f\n",
+	    statNames[id], (unsigned long long) count,
+	    (double) total / timed / 1e3, pvals[0], pvals[1], pvals[2],
+	    max / 1e3);
+  }
+}
+
+int fm_stats_write_trace(const char* path)
+{
+  FILE* out = fopen(path, "w");
+
+  if (!out)
+    return 1;
+
+  std::lock_guard<std::mutex> lock(registryMutex);
+  const char* sep = "";
+  int pid = getpid();
+
+  fprintf(out, "{\"traceEvents\": [\n");
+
+  for (const ThreadStats* ts : registry) {
+    uint64_t n = ts->traced.get();
+    uint64_t first = 0;
+
+    // Only the newest events are left in each ring
+    if (n > FM_STATS_TRACE_EVENTS)
+      first = n - FM_STATS_TRACE_EVENTS;
+
+    for (uint64_t i = first; i < n; ++i) {
+      const TraceEvent& ev = ts->trace[i % FM_STATS_TRACE_EVENTS];
+
+      fprintf(out, "%s{\"name\": \"%s\", \"ph\": \"X\", \"ts\": %.3f, "
+	      "\"dur\": %.3f, \"pid\": %d, \"tid\": %u}",
+	      sep, statNames[ev.id], ev.start / 1e3, ev.duration / 1e3,
+	      pid, ts->tid);
+      sep = ",\n";
+    }
+  }
+
+  fprintf(out, "\n], \"displayTimeUnit\": \"ns\"}\n");
+
+  return fclose(out) == 0 ? 0 : 1;
+}
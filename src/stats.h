@@ -0,0 +1,131 @@
+//===-- stats.h - Hot Path Instrumentation Header ------* C *-----===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the latency instrumentation used around
+/// backend calls and the form. It is callable from C so the ncurses
+/// code can time itself. Each thread records into its own counters
+/// and log-linear histograms; nothing is shared on the hot path, and
+/// while disabled a timed section costs a single branch. Every section
+/// is counted, but latencies are sampled from one in sixty-four unless
+/// tracing, and traces keep the newest events of each thread. Sections
+/// that aren't sampled only count down inline to the next that is,
+/// without a call or a clock read.
+///
+//===------------------------------------------------------------===//
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum fm_stat_id {
+	FM_STAT_CONNECT,
+	FM_STAT_SEND,
+	FM_STAT_RECEIVE,
+	FM_STAT_AUTOCOMPLETE,
+	FM_STAT_FORM_BUILD,
+	FM_STAT_KEYSTROKE,
+	FM_STAT_FETCH,
+	FM_STAT_COUNT
+};
+
+#define FM_STATS_ENABLED	0x01
+#define FM_STATS_TRACE		0x02
+
+/* Start value of a section that is counted but not timed */
+#define FM_STATS_UNTIMED	1
+
+/* Inlined even in unoptimized builds, where a call would cost more
+ * than the section's bookkeeping */
+#define FM_STATS_INLINE	static inline __attribute__((always_inline))
+
+/* Combination of FM_STATS_ flags, set by fm_stats_enable() */
+extern int fm_stats_flags;
+
+/* What the inline path updates for each thread, owned by its records.
+ * Only the thread writes it, and it is read with relaxed atomics. */
+struct fm_stats_thread {
+	unsigned skip[FM_STAT_COUNT];	/* Left before the next timed one */
+};
+
+/* The calling thread's fm_stats_thread, NULL until its first timed
+ * section */
+extern __thread struct fm_stats_thread* fm_stats_local;
+
+/* Turn stats on with FM_STATS_ flags, or off with 0, at startup */
+void fm_stats_enable(int flags);
+
+/* Start a timed section, returning 0 when stats are disabled */
+uint64_t fm_stats_begin_slow(enum fm_stat_id id);
+
+/* Record a section started by fm_stats_begin() */
+void fm_stats_end_slow(enum fm_stat_id id, uint64_t start);
+
+FM_STATS_INLINE uint64_t fm_stats_begin(enum fm_stat_id id)
+{
+	struct fm_stats_thread* local = fm_stats_local;
+
+	if (!fm_stats_flags)
+		return 0;
+
+	/* Counted by the sampled section that set the countdown */
+	if (local && local->skip[id]) {
+		__atomic_store_n(&local->skip[id], local->skip[id] - 1,
+				 __ATOMIC_RELAXED);
+		return FM_STATS_UNTIMED;
+	}
+
+	return fm_stats_begin_slow(id);
+}
+
+FM_STATS_INLINE void fm_stats_end(enum fm_stat_id id, uint64_t start)
+{
+	if (start > FM_STATS_UNTIMED)
+		fm_stats_end_slow(id, start);
+}
+
+/* Print count, mean, percentiles and max per section */
+void fm_stats_dump(FILE* out);
+
+/* Write recorded sections as Chrome trace-event JSON */
+int fm_stats_write_trace(const char* path);
+
+#ifdef __cplusplus
+}
+
+namespace film {
+  /// Time the enclosing scope as one section
+  class StatScope {
+  public:
+    __attribute__((always_inline)) StatScope(fm_stat_id id)
+      :_id(id), _start(fm_stats_begin(id)) {}
+    __attribute__((always_inline)) ~StatScope()
+    {
+      fm_stats_end(_id, _start);
+    }
+
+    StatScope(const StatScope&) = delete;
+    StatScope& operator=(const StatScope&) = delete;
+
+  private:
+    fm_stat_id _id;
+    uint64_t _start;
+  };
+}
+#endif /* #ifdef __cplusplus */
+
+#endif /* #ifndef STATS_H */
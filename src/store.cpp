@@ -0,0 +1,515 @@
+//===-- store.cpp - Multi-Version Record Store Source -----------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the implementation of the in-memory record
+/// store and the backend serving records from it.
+///
+//===------------------------------------------------------------===//
+
+#include "store.h"
+#include "stats.h"
+
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cstdarg>
+#include <assert.h>
+
+#define FM_STORE_CHUNK_BITS	12
+#define FM_STORE_CHUNK		(1ul << FM_STORE_CHUNK_BITS)
+#define FM_STORE_CHUNKS		16384
+#define FM_STORE_READERS	256
+
+// Reader slots hold 0 when free and FM_STORE_PINNED while a snapshot
+// is being taken, which holds back the vacuum like the oldest stamp
+#define FM_STORE_PINNED		1
+
+film::RecordStore::RecordStore(int vacuumms)
+  :_chunks(new std::atomic<std::atomic<Version*>*>[FM_STORE_CHUNKS]),
+   _clock(FM_STORE_PINNED), _size(0), _versions(0),
+   _readers(new ReaderSlot[FM_STORE_READERS])
+{
+  for (size_t i = 0; i < FM_STORE_CHUNKS; ++i)
+    _chunks[i].store(nullptr);
+
+  for (size_t i = 0; i < FM_STORE_READERS; ++i)
+    _readers[i].stamp.store(0);
+
+  if (vacuumms > 0)
+    _vacuum = std::thread(&RecordStore::runVacuum, this, vacuumms);
+}
+
+film::RecordStore::~RecordStore()
+{
+  if (_vacuum.joinable()) {
+    {
+      std::lock_guard<std::mutex> lock(_vacuummtx);
+      _stop = true;
+    }
+
+    _vacuumcv.notify_all();
+    _vacuum.join();
+  }
+
+  for (uint64_t id = 0; id < _size.load(); ++id) {
+    Version* v = head(id).load();
+
+    while (v) {
+      Version* prev = v->prev.load();
+      delete v;
+      v = prev;
+    }
+  }
+
+  for (size_t i = 0; i < FM_STORE_CHUNKS; ++i)
+    delete[] _chunks[i].load();
+}
+
+std::atomic<film::RecordStore::Version*>&
+film::RecordStore::head(uint64_t id) const
+{
+  std::atomic<Version*>* chunk =
+    _chunks[id >> FM_STORE_CHUNK_BITS].load(std::memory_order_acquire);
+
+  assert(chunk);
+
+  return chunk[id & (FM_STORE_CHUNK - 1)];
+}
+
+/// Make v the newest version of id as of commit stamp, which no
+/// snapshot sees until the clock reaches it; the caller holds the
+/// write lock
+void film::RecordStore::publish(uint64_t id, Version* v, uint64_t stamp)
+{
+  std::atomic<Version*>& h = head(id);
+
+  v->begin = stamp;
+  v->prev.store(h.load(std::memory_order_relaxed),
+		std::memory_order_relaxed);
+  h.store(v, std::memory_order_release);
+  _versions++;
+}
+
+uint64_t film::RecordStore::insert(const std::vector<const char*>& keys,
+				   const std::vector<const char*>& values)
+{
+  assert(keys.size() == values.size());
+
+  std::lock_guard<std::mutex> lock(_writemtx);
+  uint64_t id = _size.load(std::memory_order_relaxed);
+  size_t chunkno = id >> FM_STORE_CHUNK_BITS;
+
+  if (chunkno >= FM_STORE_CHUNKS) {
+    throw std::runtime_error("Record store is full");
+  }
+
+  if (_chunks[chunkno].load(std::memory_order_relaxed) == nullptr) {
+    std::atomic<Version*>* chunk = new std::atomic<Version*>[FM_STORE_CHUNK];
+
+    for (size_t i = 0; i < FM_STORE_CHUNK; ++i)
+      chunk[i].store(nullptr, std::memory_order_relaxed);
+
+    _chunks[chunkno].store(chunk, std::memory_order_release);
+  }
+
+  // Records from the form all share one set of labels
+  bool samekeys = _lastkeys && _lastkeys->size() == keys.size();
+
+  for (size_t i = 0; samekeys && i < keys.size(); ++i)
+    samekeys = (*_lastkeys)[i] == keys[i];
+
+  if (!samekeys)
+    _lastkeys.reset(new std::vector<std::string>(keys.begin(), keys.end()));
+
+  Version* v = new Version;
+  v->record.keys = _lastkeys;
+  v->record.values.assign(values.begin(), values.end());
+
+  uint64_t stamp = _clock.load(std::memory_order_relaxed) + 1;
+
+  publish(id, v, stamp);
+
+  // The size goes first, so a snapshot seeing the new stamp sees the
+  // new record too. One that sees the new size with the old stamp
+  // finds the record too new for it and trims it off.
+  _size.store(id + 1, std::memory_order_release);
+  _clock.store(stamp, std::memory_order_release);
+
+  return id;
+}
+
+void film::RecordStore::update(const std::vector<uint64_t>& ids,
+			       const std::vector<size_t>& fields,
+			       const std::vector<const char*>& values)
+{
+  assert(fields.size() == values.size());
+
+  std::lock_guard<std::mutex> lock(_writemtx);
+  std::vector<std::unique_ptr<Version>> versions;
+
+  // Every version is built before any is published, so a bad ID or
+  // field leaves the store as it was
+  for (uint64_t id : ids) {
+    if (id >= _size.load(std::memory_order_relaxed)) {
+      throw std::runtime_error("No record " + std::to_string(id));
+    }
+
+    Version* cur = head(id).load(std::memory_order_relaxed);
+
+    versions.emplace_back(new Version);
+    versions.back()->record = cur->record;
+
+    for (size_t i = 0; i < fields.size(); ++i) {
+      if (fields[i] >= cur->record.values.size()) {
+	throw std::runtime_error("No field " + std::to_string(fields[i])
+				 + " in record " + std::to_string(id));
+      }
+
+      versions.back()->record.values[fields[i]] = values[i];
+    }
+  }
+
+  _updated.reserve(_updated.size() + ids.size());
+
+  uint64_t stamp = _clock.load(std::memory_order_relaxed) + 1;
+
+  for (size_t i = 0; i < ids.size(); ++i) {
+    publish(ids[i], versions[i].release(), stamp);
+    _updated.push_back(ids[i]);
+  }
+
+  // Readers see all of the update or none of it
+  _clock.store(stamp, std::memory_order_release);
+}
+
+film::RecordStore::Snapshot::Snapshot(const RecordStore& store)
+  :_store(store), _slot(nullptr)
+{
+  for (size_t i = 0; i < FM_STORE_READERS && !_slot; ++i) {
+    uint64_t expect = 0;
+
+    if (store._readers[i].stamp.compare_exchange_strong(expect,
+							FM_STORE_PINNED))
+      _slot = &store._readers[i].stamp;
+  }
+
+  if (!_slot) {
+    throw std::runtime_error("Too many snapshots of the record store");
+  }
+
+  // The pin is visible before the clock is read, so a vacuum that
+  // missed both read the clock no later than we do
+  _stamp = store._clock.load();
+  _slot->store(_stamp);
+
+  // Records committed after the stamp can only be at the end
+  _size = store._size.load(std::memory_order_acquire);
+
+  while (_size > 0 && get(_size - 1) == nullptr)
+    _size--;
+}
+
+film::RecordStore::Snapshot::~Snapshot()
+{
+  _slot->store(0, std::memory_order_release);
+}
+
+const film::RecordStore::Record*
+film::RecordStore::Snapshot::get(uint64_t id) const
+{
+  if (id >= _store._size.load(std::memory_order_acquire))
+    return nullptr;
+
+  Version* v = _store.head(id).load(std::memory_order_acquire);
+
+  while (v && v->begin > _stamp)
+    v = v->prev.load(std::memory_order_acquire);
+
+  return v ? &v->record : nullptr;
+}
+
+std::unique_ptr<film::RecordStore::Snapshot>
+film::RecordStore::snapshot() const
+{
+  return std::unique_ptr<Snapshot>(new Snapshot(*this));
+}
+
+/// Oldest stamp a live or starting snapshot may read at
+uint64_t film::RecordStore::oldestStamp() const
+{
+  uint64_t oldest = _clock.load();
+
+  for (size_t i = 0; i < FM_STORE_READERS; ++i) {
+    uint64_t s = _readers[i].stamp.load();
+
+    if (s != 0 && s < oldest)
+      oldest = s;
+  }
+
+  return oldest;
+}
+
+size_t film::RecordStore::vacuum()
+{
+  std::lock_guard<std::mutex> pass(_passmtx);
+  std::vector<uint64_t> ids;
+  std::vector<uint64_t> again;
+  size_t freed = 0;
+
+  {
+    std::lock_guard<std::mutex> lock(_writemtx);
+    ids.swap(_updated);
+  }
+
+  std::sort(ids.begin(), ids.end());
+  ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+
+  uint64_t oldest = oldestStamp();
+
+  for (uint64_t id : ids) {
+    Version* v = head(id).load(std::memory_order_acquire);
+
+    // Keep the version the oldest snapshot sees; no snapshot looks
+    // past it, and writers only ever touch the head
+    while (v && v->begin > oldest)
+      v = v->prev.load(std::memory_order_acquire);
+
+    if (v) {
+      Version* old = v->prev.exchange(nullptr);
+
+      while (old) {
+	Version* prev = old->prev.load();
+	delete old;
+	old = prev;
+	freed++;
+      }
+    }
+
+    if (head(id).load(std::memory_order_acquire) != v)
+      again.push_back(id);
+  }
+
+  {
+    std::lock_guard<std::mutex> lock(_writemtx);
+    _updated.insert(_updated.end(), again.begin(), again.end());
+  }
+
+  _versions -= freed;
+
+  return freed;
+}
+
+void film::RecordStore::runVacuum(int vacuumms)
+{
+  std::unique_lock<std::mutex> lock(_vacuummtx);
+
+  while (!_stop) {
+    _vacuumcv.wait_for(lock, std::chrono::milliseconds(vacuumms));
+
+    if (_stop)
+      break;
+
+    lock.unlock();
+    vacuum();
+    lock.lock();
+  }
+}
+
+/// Split "Field=value" into its sides, or leave field empty for all
+static void parseFilter(const std::string& query, std::string& field,
+			std::string& value)
+{
+  size_t eq = query.find('=');
+
+  field.clear();
+  value.clear();
+
+  if (query.empty() || query == "*")
+    return;
+
+  if (eq == std::string::npos) {
+    throw std::runtime_error("Query must be Field=value or *");
+  }
+
+  field = query.substr(0, eq);
+  value = query.substr(eq + 1);
+
+  field.erase(field.find_last_not_of(' ') + 1);
+  value.erase(0, value.find_first_not_of(' '));
+}
+
+static bool matches(const film::RecordStore::Record& rec,
+		    const std::string& field, const std::string& value)
+{
+  if (field.empty())
+    return true;
+
+  for (size_t i = 0; i < rec.keys->size(); ++i) {
+    if ((*rec.keys)[i] == field)
+      return rec.values[i] == value;
+  }
+
+  return false;
+}
+
+/// Write a record as an NDJSON line without its newline
+static void appendRecord(std::string& out, film::Serializer& ser,
+			 const film::RecordStore::Record& rec)
+{
+  std::vector<const char*> keys;
+  std::vector<const char*> values;
+
+  for (size_t i = 0; i < rec.values.size(); ++i) {
+    keys.push_back((*rec.keys)[i].c_str());
+    values.push_back(rec.values[i].c_str());
+  }
+
+  ser.write(out, keys, values);
+  out.pop_back();
+}
+
+/// Cursor over the records of one snapshot
+class StoreCursor :public film::Cursor {
+public:
+  StoreCursor(const film::RecordStore& store, const std::string& query)
+    :_snap(store.snapshot())
+  {
+    std::string value;
+
+    parseFilter(query, _field, value);
+
+    if (_field.empty())
+      return;
+
+    // Only the matching IDs are kept, not the records
+    for (uint64_t id = 0; id < _snap->size(); ++id) {
+      if (matches(*_snap->get(id), _field, value))
+	_ids.push_back(id);
+    }
+  }
+
+  virtual size_t fetch(size_t row, size_t n,
+		       std::vector<const char*>& rows) override
+  {
+    film::StatScope stat(FM_STAT_FETCH);
+    size_t total = size();
+
+    _page.clear();
+    rows.clear();
+
+    for (size_t i = row; i < total && i - row < n; ++i) {
+      _page.emplace_back();
+      appendRecord(_page.back(), _ser,
+		   *_snap->get(_field.empty() ? i : _ids[i]));
+    }
+
+    for (const std::string& s : _page)
+      rows.push_back(s.c_str());
+
+    return rows.size();
+  }
+
+  virtual size_t size() const override
+  {
+    return _field.empty() ? _snap->size() : _ids.size();
+  }
+
+private:
+  std::unique_ptr<film::RecordStore::Snapshot> _snap;
+  std::string _field;
+  std::vector<uint64_t> _ids;
+  film::NdjsonSerializer _ser;
+  std::vector<std::string> _page;
+};
+
+film::StoreBackend::StoreBackend()
+{
+  flags = flags | FM_BE_RECEIVE_ENABLED | FM_BE_CONCURRENT_READS;
+  init();
+}
+
+void film::StoreBackend::send(std::vector<const char*>* v...)
+{
+  StatScope stat(FM_STAT_SEND);
+  std::va_list args;
+
+  assert(v);
+
+  va_start(args, v);
+
+  std::vector<const char*>* varg = va_arg(args,
+					  std::vector<const char*>*);
+
+  assert(varg);
+
+  va_end(args);
+
+  _store.insert(*v, *varg);
+}
+
+const char* film::StoreBackend::receive(const char* query)
+{
+  if ((flags & FM_BE_RECEIVE_ENABLED) == 0) {
+    return "";
+  }
+
+  assert(query);
+
+  StatScope stat(FM_STAT_RECEIVE);
+  std::unique_ptr<RecordStore::Snapshot> snap = _store.snapshot();
+  NdjsonSerializer ser;
+  std::string field;
+  std::string value;
+
+  parseFilter(normalize(query), field, value);
+  resultbuffer.clear();
+
+  for (uint64_t id = 0; id < snap->size(); ++id) {
+    const RecordStore::Record* rec = snap->get(id);
+
+    if (matches(*rec, field, value)) {
+      resultbuffer.emplace_back();
+      appendRecord(resultbuffer.back(), ser, *rec);
+    }
+  }
+
+  return "";
+}
+
+uint64_t film::StoreBackend::version(const char* query)
+{
+  return _store.stamp();
+}
+
+std::unique_ptr<film::Cursor> film::StoreBackend::cursor(const char* query)
+{
+  assert(query);
+
+  return std::unique_ptr<Cursor>(new StoreCursor(_store, normalize(query)));
+}
+
+void film::StoreBackend::update(const std::vector<uint64_t>& ids,
+			       const std::vector<size_t>& fields,
+			       const std::vector<const char*>& values)
+{
+  StatScope stat(FM_STAT_SEND);
+
+  _store.update(ids, fields, values);
+}
+
+void film::StoreBackend::connect()
+{
+  StatScope stat(FM_STAT_CONNECT);
+}
+
+void film::StoreBackend::init() {};
@@ -0,0 +1,165 @@
+//===-- store.h - Multi-Version Record Store Header ---* C++ *----===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the definitions of the in-memory record store
+/// that lets readers scan consistent snapshots while records are
+/// written, and of the backend serving records from it.
+///
+//===------------------------------------------------------------===//
+
+#ifndef STORE_H
+#define STORE_H
+
+#include "backend.h"
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+namespace film {
+  /// In-memory records with multi-version concurrency control
+  ///
+  /// Every write appends a new version of a record stamped with the
+  /// next commit timestamp; nothing is changed in place. A Snapshot
+  /// fixes a timestamp and sees each record as of then, without
+  /// taking a lock, however long it is held. Writers only serialize
+  /// among themselves. A vacuum thread frees versions older than the
+  /// oldest live snapshot needs.
+  class RecordStore {
+  public:
+    /// One version of a record
+    struct Record {
+      std::shared_ptr<const std::vector<std::string>> keys;
+      std::vector<std::string> values;
+    };
+
+    /// Consistent view of the store, which must not outlive it
+    class Snapshot {
+    public:
+      ~Snapshot();
+
+      Snapshot(const Snapshot&) = delete;
+      Snapshot& operator=(const Snapshot&) = delete;
+
+      /// Commit timestamp the snapshot sees up to
+      uint64_t stamp() const { return _stamp; }
+
+      /// Number of records, with IDs 0 to size() - 1
+      uint64_t size() const { return _size; }
+
+      /// Record id as of the snapshot, or null if it didn't exist
+      const Record* get(uint64_t id) const;
+
+    private:
+      friend class RecordStore;
+      Snapshot(const RecordStore& store);
+
+      const RecordStore& _store;
+      std::atomic<uint64_t>* _slot;
+      uint64_t _stamp;
+      uint64_t _size;
+    };
+
+    RecordStore(int vacuumms = 100);
+    ~RecordStore();
+
+    RecordStore(const RecordStore&) = delete;
+    RecordStore& operator=(const RecordStore&) = delete;
+
+    /// Add a record, returning its ID
+    uint64_t insert(const std::vector<const char*>& keys,
+		    const std::vector<const char*>& values);
+
+    /// Write new versions of the records with the fields at the
+    /// given indexes changed, all in one commit
+    void update(const std::vector<uint64_t>& ids,
+		const std::vector<size_t>& fields,
+		const std::vector<const char*>& values);
+
+    /// Take a snapshot of the latest commit
+    std::unique_ptr<Snapshot> snapshot() const;
+
+    /// Timestamp of the latest commit
+    uint64_t stamp() const { return _clock.load(); }
+
+    /// Free versions no snapshot can see, returning how many
+    size_t vacuum();
+
+    /// Versions currently held, for the benchmarks
+    size_t versions() const { return _versions.load(); }
+
+  private:
+    struct Version {
+      uint64_t begin;
+      std::atomic<Version*> prev;
+      Record record;
+    };
+
+    struct alignas(64) ReaderSlot {
+      std::atomic<uint64_t> stamp;
+    };
+
+    std::atomic<Version*>& head(uint64_t id) const;
+    void publish(uint64_t id, Version* v, uint64_t stamp);
+    uint64_t oldestStamp() const;
+    void runVacuum(int vacuumms);
+
+    // Record heads live in fixed chunks that never move, so readers
+    // index them without a lock
+    std::unique_ptr<std::atomic<std::atomic<Version*>*>[]> _chunks;
+
+    std::atomic<uint64_t> _clock;
+    std::atomic<uint64_t> _size;
+    std::atomic<size_t> _versions;
+    mutable std::unique_ptr<ReaderSlot[]> _readers;
+
+    // Held by writers and the vacuum
+    std::mutex _writemtx;
+    std::shared_ptr<const std::vector<std::string>> _lastkeys;
+    std::vector<uint64_t> _updated;
+
+    std::mutex _passmtx;
+    std::thread _vacuum;
+    std::mutex _vacuummtx;
+    std::condition_variable _vacuumcv;
+    bool _stop = false;
+  };
+
+  /// Backend holding records in a RecordStore
+  ///
+  /// receive() takes "Field=value" to match one field, or an empty
+  /// query or "*" for every record, and answers from a snapshot as
+  /// NDJSON. Cursors keep their snapshot, so paging stays consistent
+  /// while records are written.
+  class StoreBackend :public Backend {
+  public:
+    StoreBackend();
+
+    virtual void send(std::vector<const char*>* v...) override;
+    virtual const char* receive(const char* query) override;
+    virtual void connect() override;
+    virtual void init() override;
+    virtual uint64_t version(const char* query) override;
+    virtual std::unique_ptr<Cursor> cursor(const char* query) override;
+    virtual void update(const std::vector<uint64_t>& ids,
+			const std::vector<size_t>& fields,
+			const std::vector<const char*>& values) override;
+
+    RecordStore& store() { return _store; }
+
+  private:
+    RecordStore _store;
+  };
+}
+
+#endif // #ifndef STORE_H
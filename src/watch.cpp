@@ -0,0 +1,213 @@
+//===-- watch.cpp - Watch Folder Source -------------------------===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the inotify implementation of the watch
+/// folder.
+///
+//===------------------------------------------------------------===//
+
+#include "watch.h"
+#include "scan.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/inotify.h>
+
+film::WatchFolder::WatchFolder(const std::string& dir,
+			       const std::string& cursorfile,
+			       int debouncems)
+  :_dir(dir), _debounce(debouncems)
+{
+  _fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+  if (_fd < 0)
+    throw std::runtime_error("Failed to initialize inotify");
+
+  // Watch before sweeping so nothing lands in between unseen
+  if (inotify_add_watch(_fd, dir.c_str(),
+			IN_CLOSE_WRITE | IN_MOVED_TO | IN_MODIFY) < 0) {
+    close(_fd);
+    throw std::runtime_error("Failed to watch " + dir + ": "
+			     + std::strerror(errno));
+  }
+
+  std::ifstream in(cursorfile);
+  std::string line;
+
+  while (std::getline(in, line)) {
+    if (!line.empty())
+      _ingested.insert(std::move(line));
+  }
+
+  in.close();
+
+  _cursor.open(cursorfile, std::ios::app);
+
+  if (_cursor.fail()) {
+    close(_fd);
+    throw std::runtime_error("Failed to open cursor file "
+			     + cursorfile);
+  }
+
+  sweep();
+}
+
+film::WatchFolder::~WatchFolder()
+{
+  close(_fd);
+}
+
+/// Start or restart the quiet period of a file
+void film::WatchFolder::queue(const std::string& path, clock::time_point now)
+{
+  Pending& p = _pending[path];
+
+  p.seen = now;
+  p.key = cursorKey(path);
+}
+
+/// Queue every scan file in the folder, any of which may still be
+/// being written
+void film::WatchFolder::sweep()
+{
+  clock::time_point now = clock::now();
+
+  for (const std::filesystem::directory_entry& de :
+	 std::filesystem::directory_iterator(_dir)) {
+    if (de.is_regular_file() && isScanFile(de.path().string()))
+      queue(de.path().string(), now);
+  }
+}
+
+/// Identify a file by path, size and modification time so that a
+/// replaced file is ingested again
+std::string film::WatchFolder::cursorKey(const std::string& path)
+{
+  struct stat st;
+
+  if (stat(path.c_str(), &st) != 0)
+    return "";
+
+  return path + '\t' + std::to_string(st.st_size) + '\t'
+    + std::to_string(st.st_mtim.tv_sec) + '.'
+    + std::to_string(st.st_mtim.tv_nsec);
+}
+
+void film::WatchFolder::readEvents()
+{
+  alignas(struct inotify_event) char buf[16384];
+  ssize_t len;
+
+  while ((len = read(_fd, buf, sizeof(buf))) > 0) {
+    clock::time_point now = clock::now();
+
+    for (char* p = buf; p < buf + len;) {
+      const struct inotify_event* ev = (const struct inotify_event*) p;
+      p += sizeof(struct inotify_event) + ev->len;
+
+      // Events were dropped, so fall back to looking at everything
+      if (ev->mask & IN_Q_OVERFLOW) {
+	sweep();
+	continue;
+      }
+
+      if (ev->len == 0 || !isScanFile(ev->name))
+	continue;
+
+      // Joined as directory_iterator joins them, so an event and a
+      // sweep name the same file alike
+      std::string path = (std::filesystem::path(_dir) / ev->name).string();
+
+      // A write after close restarts the quiet period, but writes
+      // alone don't make a file a candidate
+      if (ev->mask & (IN_CLOSE_WRITE | IN_MOVED_TO)
+	  || _pending.count(path) != 0)
+	queue(path, now);
+    }
+  }
+}
+
+std::vector<std::string> film::WatchFolder::wait(int timeoutms)
+{
+  clock::time_point deadline = clock::now()
+    + std::chrono::milliseconds(timeoutms);
+  std::vector<std::string> ready;
+
+  for (;;) {
+    readEvents();
+
+    clock::time_point now = clock::now();
+    clock::time_point next = deadline;
+
+    for (auto it = _pending.begin(); it != _pending.end();) {
+      clock::time_point due = it->second.seen + _debounce;
+
+      if (due > now) {
+	next = std::min(next, due);
+	++it;
+	continue;
+      }
+
+      std::string key = cursorKey(it->first);
+
+      // A writer that inotify can't see, such as one over NFS, still
+      // shows in the size or modification time
+      if (key != it->second.key) {
+	it->second.seen = now;
+	it->second.key = key;
+	next = std::min(next, now + _debounce);
+	++it;
+	continue;
+      }
+
+      if (!key.empty() && _ingested.count(key) == 0)
+	ready.push_back(it->first);
+
+      it = _pending.erase(it);
+    }
+
+    if (!ready.empty() || now >= deadline) {
+      std::sort(ready.begin(), ready.end());
+      return ready;
+    }
+
+    struct pollfd pfd = { _fd, POLLIN, 0 };
+    auto wait = std::chrono::duration_cast<std::chrono::milliseconds>
+      (next - now).count() + 1;
+
+    // Let the caller look at its signal flags on interruption
+    if (poll(&pfd, 1, wait) < 0 && errno == EINTR)
+      return ready;
+  }
+}
+
+void film::WatchFolder::commit(const std::vector<std::string>& paths)
+{
+  for (const std::string& path : paths) {
+    std::string key = cursorKey(path);
+
+    if (key.empty())
+      continue;
+
+    _cursor << key << '\n';
+    _ingested.insert(std::move(key));
+  }
+
+  _cursor.flush();
+}
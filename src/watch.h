@@ -0,0 +1,76 @@
+//===-- watch.h - Watch Folder Header -----------------* C++ *----===//
+//
+// Part of film-manager project, Copyright 2021 Tyler J. Anderson This
+// software is released under the BSD 3-Clause "New" or "Revised"
+// License. You should have received a copy of the license with this
+// source distribution
+//
+// SPDX-License-Identifier: BSD-3-Clause
+//
+//===------------------------------------------------------------===//
+///
+/// \file
+/// This file contains the definitions for following a hot folder
+/// that a scanner drops files into.
+///
+//===------------------------------------------------------------===//
+
+#ifndef WATCH_H
+#define WATCH_H
+
+#include <vector>
+#include <string>
+#include <fstream>
+#include <chrono>
+#include <unordered_set>
+#include <unordered_map>
+
+namespace film {
+  /// Report scan files in a directory once they are fully written
+  ///
+  /// Files already in the directory are reported first, then new
+  /// ones as inotify sees them closed or moved in. A file is only
+  /// ready once it has been quiet for the debounce interval and its
+  /// size and modification time held still across it. Files
+  /// passed to commit() are appended to the cursor file and are not
+  /// reported again, even across restarts, unless they change.
+  class WatchFolder {
+  public:
+    WatchFolder(const std::string& dir,
+		const std::string& cursorfile,
+		int debouncems = 250);
+    ~WatchFolder();
+
+    WatchFolder(const WatchFolder&) = delete;
+    WatchFolder& operator=(const WatchFolder&) = delete;
+
+    /// Wait up to timeoutms for ready files, returning them in batch
+    std::vector<std::string> wait(int timeoutms);
+
+    /// Mark files as ingested
+    void commit(const std::vector<std::string>& paths);
+
+  private:
+    typedef std::chrono::steady_clock clock;
+
+    /// Time a file was last seen changing and its cursor key then
+    struct Pending {
+      std::chrono::steady_clock::time_point seen;
+      std::string key;
+    };
+
+    std::string cursorKey(const std::string& path);
+    void queue(const std::string& path, clock::time_point now);
+    void sweep();
+    void readEvents();
+
+    std::string _dir;
+    int _fd = -1;
+    std::chrono::milliseconds _debounce;
+    std::ofstream _cursor;
+    std::unordered_set<std::string> _ingested;
+    std::unordered_map<std::string, Pending> _pending;
+  };
+}
+
+#endif // #ifndef WATCH_H